@@ -15,9 +15,11 @@
 #include "xwp/stringhelp.h"
 #include "xwp/debug.h"
 #include "xwp/regex.h"
+#include "xwp/mappedfile.h"
 
 #include "phoxygen/formatter.h"
 
+#include <deque>
 #include <memory>
 #include <map>
 
@@ -61,6 +63,91 @@ typedef map<string, PPageComment> PagesMap;
 class MainPageComment;
 typedef shared_ptr<MainPageComment> PMainPageComment;
 
+class RESTComment;
+typedef shared_ptr<RESTComment> PRESTComment;
+typedef map<string, PRESTComment> RESTMap;
+
+
+/***************************************************************************
+ *
+ *  CommentText
+ *
+ **************************************************************************/
+
+/**
+ *  The text of a doc comment, stored as the source lines that it consists of. The lines
+ *  point into the buffer of the source file, which is kept alive for as long as the
+ *  comment is, so comment text is not copied while parsing. The leading " * " of each
+ *  line is only stripped in toString(), when the comment gets formatted.
+ *
+ *  Without a file (when a big file is streamed, see PhpScanner), the lines are copied
+ *  instead, into strings that all copies of the CommentText share.
+ */
+class CommentText
+{
+    PMappedFile             _pFile;
+    shared_ptr<deque<string>> _pCopies;
+    vector<string_view>     _vLines;
+
+    void addCopy(string_view svLine)
+    {
+        if (!_pCopies)
+            _pCopies = make_shared<deque<string>>();
+        _pCopies->emplace_back(svLine);
+        _vLines.push_back(_pCopies->back());
+    }
+
+public:
+    CommentText()
+    { }
+
+    CommentText(PMappedFile pFile)
+        : _pFile(pFile)
+    { }
+
+    bool empty() const
+    {
+        return _vLines.empty();
+    }
+
+    void addLine(string_view svLine)
+    {
+        if (_pFile)
+            _vLines.push_back(svLine);
+        else
+            addCopy(svLine);
+    }
+
+    /**
+     *  Appends the next piece of a line that was too long for the stream buffer (see
+     *  PhpScanner) to the last line. This only happens when streaming, so that line is
+     *  always a copy, and it is still the last in _pCopies because the comment is being
+     *  built.
+     */
+    void continueLine(string_view svPiece)
+    {
+        if (_pFile || _vLines.empty())
+            addLine(svPiece);
+        else
+        {
+            _pCopies->back().append(svPiece);
+            _vLines.back() = _pCopies->back();
+        }
+    }
+
+    void removeLastLine()
+    {
+        if (!_vLines.empty())
+            _vLines.pop_back();
+    }
+
+    void append(const CommentText &text);
+
+    string toString() const;
+
+    static string_view StripPrefix(string_view svLine);
+};
+
 
 /***************************************************************************
  *
@@ -72,7 +159,7 @@ class CommentBase
 {
     static const string s_strUnknown;
 
-protected:
+public:
     enum class Type
     {
         PAGE,
@@ -83,10 +170,11 @@ protected:
         REST
     };
 
+protected:
     Type    _type;
     string  _keyword;
     string  _identifier;
-    string  _comment;
+    CommentText _comment;
     string  _file;
     int     _linenoFirst;
     int     _linenoLast;
@@ -94,10 +182,26 @@ protected:
     string  _strTargetHTML,
             _strTargetLaTeX;
 
+    /**
+     *  What a \ref in the comment text refers to; see bindExplicitRef(). All pointers
+     *  are NULL if the \ref is invalid.
+     */
+    struct ExplicitRef
+    {
+        TableComment    *pTable = NULL;
+        PageComment     *pPage = NULL;
+        ClassComment    *pClass = NULL;         // For a function in that class, named in strFunction.
+        string          strFunction;
+    };
+
+    // The \refs and REST API references in the comment text, bound by resolveRefs().
+    map<string, ExplicitRef>    _mapExplicitRefs;
+    map<string, RESTComment*>   _mapRESTRefs;
+
     CommentBase(Type theType,
                 const string &strKeyword,
                 const string &strIdentifier,
-                const string &strComment,
+                const CommentText &comment,
                 const string &strFile,
                 int linenoFirst,
                 int linenoLast,
@@ -105,6 +209,8 @@ protected:
 
     void makeTargets(const string &strTargetBase);
 
+    ExplicitRef bindExplicitRef(const string &strMatch);
+
 public:
     Type getType() const
     {
@@ -135,17 +241,22 @@ public:
         return NULL;
     }
 
-    void append(string strLine)
+    void append(const CommentText &text)
     {
-        _comment += strLine;
+        _comment.append(text);
     }
 
     string formatContext();
 
     virtual string formatComment(OutputMode mode);
 
+    void resolveRefs();
+
     string resolveExplicitRef(FormatterBase &fmt,
-                              const string &strMatch);
+                              const string &strMatch) const;
+
+    string resolveRESTRef(FormatterBase &fmt,
+                          const string &strIdentifier) const;
 };
 
 
@@ -174,6 +285,8 @@ public:
                              int linenoFirst,
                              int linenoLast);
 
+    static void Add(PPageComment p);
+
     virtual string getTitle(OutputMode mode) override;
 
     string makeLink(FormatterBase &fmt)
@@ -219,10 +332,6 @@ public:
  *
  **************************************************************************/
 
-class RESTComment;
-typedef shared_ptr<RESTComment> PRESTComment;
-typedef map<string, PRESTComment> RESTMap;
-
 class RESTComment : public CommentBase
 {
     string      _strMethod;
@@ -232,7 +341,7 @@ class RESTComment : public CommentBase
     RESTComment(const string &strMethod,
                 const string &strName,
                 const string &strArgs,
-                const string &strComment,
+                const CommentText &comment,
                 const string &strInputFile,
                 int linenoFirst,
                 int linenoLast);
@@ -240,11 +349,13 @@ public:
     static PRESTComment Make(const string &strMethod,
                              const string &strName,
                              const string &strArgs,
-                             const string &strComment,
+                             const CommentText &comment,
                              const string &strInputFile,
                              int linenoFirst,
                              int linenoLast);
 
+    static void Add(PRESTComment p);
+
     virtual string getTitle(OutputMode mode) override;
 
     string makeLink(FormatterBase &fmt)
@@ -280,19 +391,53 @@ public:
  *
  **************************************************************************/
 
+/**
+ *  A column in a CREATE TABLE statement.
+ */
+struct TableColumn
+{
+    string      strName;
+    string      strType;            // E.g. "VARCHAR(100)".
+    string      strConstraints;     // Everything after the type, e.g. "NOT NULL REFERENCES groups(gid)".
+};
+typedef vector<TableColumn> TableColumnsVector;
+
+/**
+ *  A REFERENCES clause in a CREATE TABLE statement, either in a column definition
+ *  or in a FOREIGN KEY table constraint.
+ */
+struct TableReference
+{
+    string      strColumns;         // Referencing column(s), comma-separated.
+    string      strTable;           // Referenced table.
+    string      strRefColumns;      // Referenced column(s), comma-separated; can be empty.
+    size_t      iLine;              // Where strTable is in the definition lines, for linking.
+    size_t      ofs;
+    TableComment *pTarget = nullptr;    // Set by TableComment::ResolveReferences() if the table exists.
+};
+typedef vector<TableReference> TableReferencesVector;
+
 class TableComment : public CommentBase
 {
-    StringVector _vDefinitionLines;
+    StringVector            _vDefinitionLines;
+
+    // Parsed from the definition lines by parseDefinition().
+    TableColumnsVector      _vColumns;
+    StringVector            _vConstraints;          // Table constraints like "PRIMARY KEY (a, b)".
+    TableReferencesVector   _vReferences;
+
+    // Filled by ResolveReferences(). No shared pointers because tables can reference themselves.
+    vector<pair<TableComment*, const TableReference*>> _vReferencedBy;
 
     TableComment(const string &strIdentifier,
-                 const string &strComment,
+                 const CommentText &comment,
                  const string &strInputFile,
                  int linenoFirst,
                  int linenoLast)
         : CommentBase(Type::TABLE,
                       "",
                       strIdentifier,
-                      strComment,
+                      comment,
                       strInputFile,
                       linenoFirst,
                       linenoLast,
@@ -301,12 +446,33 @@ class TableComment : public CommentBase
 
 public:
     static PTableComment Make(const string &strIdentifier,
-                              const string &strComment,
+                              const CommentText &comment,
                               const string &strInputFile,
                               int linenoFirst,
                               int linenoLast);
 
-    void processInputLine(const string &strLine, State &state);
+    static void Add(PTableComment p);
+
+    void processInputLine(string_view strLine, State &state);
+
+    void parseDefinition();
+
+    const TableColumnsVector& getColumns() const
+    {
+        return _vColumns;
+    }
+
+    const StringVector& getConstraints() const
+    {
+        return _vConstraints;
+    }
+
+    const TableReferencesVector& getReferences() const
+    {
+        return _vReferences;
+    }
+
+    static void ResolveReferences();
 
     virtual string getTitle(OutputMode mode) override;
 
@@ -335,22 +501,27 @@ class ClassComment : public CommentBase
     FunctionsMap        _mapMembers;
 
     StringVector        _vParents;          // Classes and interfaces this class extends / implements
+    vector<ClassComment*> _vParentClasses;  // Those of _vParents that are documented, see ResolveParents().
+    bool                _fUnknownParents = false;
     ClassesVector       _vChildren;
 
     StringVector        _vImplements;
     StringVector        _vExtends;
 
-    // Regex for class linkification. Instantiate them in the class data so we don't have to recompile them.
-    Regex               _reClassHTML;
-    Regex               _reClassLaTeX;
+    // What LinkifyClasses() puts in place of the class name.
+    string              _strSelfHTML;
+    string              _strOtherHTML;
+    string              _strOtherLaTeX;
 
-    string              _strReplSelfHTML;
-    string              _strReplOtherHTML;
-    string              _strReplOtherLaTeX;
+    // Regex for class linkification, only for class names that are not plain identifiers,
+    // which LinkifyClasses() cannot look up by name. Instantiate them in the class data so
+    // we don't have to recompile them.
+    unique_ptr<Regex>   _pReClassHTML;
+    unique_ptr<Regex>   _pReClassLaTeX;
 
     ClassComment(const string &strKeyword,
                  const string &strIdentifier,
-                 const string &strComment,
+                 const CommentText &comment,
                  const string &strInputFile,
                  int linenoFirst,
                  int linenoLast);
@@ -358,11 +529,13 @@ class ClassComment : public CommentBase
 public:
     static PClassComment Make(const string &strKeyword,
                               const string &strIdentifier,
-                              const string &strComment,
+                              const CommentText &comment,
                               const string &strInputFile,
                               int linenoFirst,
                               int linenoLast);
 
+    static void Add(PClassComment p);
+
     void addImplements(const string &str)
     {
         _vImplements.push_back(str);
@@ -405,6 +578,15 @@ public:
         return _vChildren;
     }
 
+    /**
+     *  Returns true if any of the parents are not documented, in which case the class list
+     *  shows the class at the top level. Valid after ResolveParents().
+     */
+    bool hasUnknownParents() const
+    {
+        return _fUnknownParents;
+    }
+
     const FunctionsVector& getMembers()
     {
         return _vMembers;
@@ -422,6 +604,8 @@ public:
                     const string &strDisplay,
                     const string *pstrAnchor);
 
+    static void ResolveParents();
+
     static void LinkifyClasses(FormatterBase &fmt,
                                string &str,
                                const string *pstrSelf);
@@ -448,17 +632,24 @@ class FunctionComment : public CommentBase
     PClassComment   _pClass;
     ParamsVector    _vParams;
 
+    // State of parseArguments() between the lines of a function header.
+    string          _strPendingParam;
+    uint            _uDepth = 0;
+    char            _cQuote = 0;
+
+    void addParam(string_view svParam);
+
 public:
     FunctionComment(const string &strKeyword,
                     const string &strIdentifier,
-                    const string &strComment,
+                    const CommentText &comment,
                     const string &strInputFile,
                     int linenoFirst,
                     int linenoLast)
         : CommentBase(Type::FUNCTION,
                       strKeyword,
                       strIdentifier,
-                      strComment,
+                      comment,
                       strInputFile,
                       linenoFirst,
                       linenoLast,
@@ -473,11 +664,15 @@ public:
         return _pClass.get();
     }
 
+    static void Add(PFunctionComment p);
+
     void setClass(PClassComment pClass);
 
-    void parseParam(string &oneParam, const string &descr);
+    void parseArguments(string_view strLine, State &state);
+
+    void linkifyParams();
 
-    void parseArguments(const string &strLine, State &state);
+    static void LinkifyAllParams();
 
     string formatFunction(FormatterBase &fmt, bool fLong);
 };
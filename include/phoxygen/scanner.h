@@ -0,0 +1,118 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include "xwp/basetypes.h"
+#include "xwp/chunkedfile.h"
+
+/**
+ *  Returns true if c can be part of a PHP identifier.
+ */
+inline bool isIdentifierChar(char c)
+{
+    return (isalnum((unsigned char)c)) || (c == '_') || ((unsigned char)c >= 0x80);
+}
+
+/**
+ *  A line that PhpScanner::next() hands back to the parser.
+ */
+struct ScannedLine
+{
+    enum class Type
+    {
+        DOC_OPEN,           // First line of a doc comment (the one with the slash and two asterisks).
+        DOC_LINE,           // Line inside a doc comment, or the text of a one-line doc comment.
+        DOC_CLOSE,          // Line with the end of a doc comment.
+        CODE                // Any other line that is not blank; only returned if requested.
+    };
+
+    Type            type;
+    string_view     svLine;
+    int             lineno;
+    bool            fContinued = false;     // Next piece of a long doc comment line; see PhpScanner.
+};
+
+/**
+ *  Hand-written PHP lexer that walks a source file once and returns the lines that
+ *  parseFile() needs to look at.
+ *
+ *  The scanner keeps track of the lexical context (HTML outside of PHP tags, code,
+ *  string literals, heredocs and nowdocs, and comments), so a slash and two asterisks
+ *  only start a doc comment in code, never in a string, a heredoc or another comment.
+ *  Like the line-based parser before it, a doc comment must be the first thing on its
+ *  line; text after the end of a doc comment is ignored.
+ *
+ *  A doc comment that opens and closes on the same line is returned as DOC_OPEN, a
+ *  DOC_LINE with its text (if any) and DOC_CLOSE, all with the same line number.
+ *
+ *  Code lines are only needed after a doc comment, until the declaration that it
+ *  belongs to has been parsed. The caller says with every call to next() whether it
+ *  wants them; if not, the scanner uses a vectorized search (see findFirstOfCountingLines())
+ *  to jump over all lines that have none of the bytes that could change the lexical
+ *  context, and only lexes the lines in between.
+ *
+ *  The scanner either works on a whole file in memory or, in streaming mode, reads the
+ *  file through the fixed-size buffer of a ChunkedFile. In streaming mode, the lines
+ *  that next() returns are only valid until the next call. A line that does not fit into
+ *  the buffer is lexed in pieces, with the context carried from one piece to the next.
+ *  In a doc comment, every piece is returned, the later ones with fContinued set,
+ *  and the piece with the end of the comment as DOC_CLOSE. Of other lines only the first
+ *  piece is returned, with a warning if it is a code line that the caller asked for.
+ */
+class PhpScanner : public ProhibitCopy
+{
+    enum class Context
+    {
+        HTML,
+        CODE,
+        SINGLE_QUOTED,
+        DOUBLE_QUOTED,
+        BACKTICK,
+        HEREDOC,
+        LINE_COMMENT,                       // Only carried from one piece of a long line to the next.
+        BLOCK_COMMENT,
+        DOC_COMMENT
+    };
+
+    ChunkedFile     *_pChunked = nullptr;   // Only in streaming mode.
+    string_view     _svFile;                // The whole file, or the buffer of _pChunked.
+    size_t          _ofs = 0;               // Start of the next line, or of the rest of a long line.
+    bool            _fLineStart = true;     // False while in the middle of a long line.
+    int             _lineno = 0;
+    Context         _ctx = Context::HTML;
+    string          _strHeredocLabel;
+
+    ScannedLine     _aPending[2];           // Rest of a one-line doc comment.
+    uint            _cPending = 0;
+    uint            _iPending = 0;
+
+    bool lexLine(string_view svLine,
+                 bool fComplete,
+                 size_t &ofsDocClose,
+                 size_t &cbLexed);
+
+    bool refill();
+
+    void skipQuietLines();
+
+    bool peekLine(string_view &svLine,
+                  bool &fComplete);
+
+public:
+    PhpScanner(string_view svFile);
+    PhpScanner(ChunkedFile &file);
+
+    bool next(ScannedLine &line,
+              bool fWantCode);
+};
+
+#endif
@@ -12,6 +12,7 @@
 #define XWP_BASETYPES_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <set>
 
@@ -0,0 +1,101 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#ifndef XWP_CHUNKEDFILE_H
+#define XWP_CHUNKEDFILE_H
+
+#include "xwp/basetypes.h"
+
+namespace XWP
+{
+
+/***************************************************************************
+ *
+ *  ChunkedFile
+ *
+ **************************************************************************/
+
+/**
+ *  Sequential read access to a file through a buffer of a fixed size, for files that
+ *  are too big to be kept in memory in one piece (see MappedFile for the others).
+ *
+ *  The caller looks at the data in view(), drops what it has processed with consume()
+ *  and calls read() to move the rest to the front of the buffer and fill it up again.
+ *  Memory use never exceeds the buffer size, no matter how big the file is.
+ *
+ *  With fCheckUTF8, the data is checked for valid UTF-8 as it is read. view() then only
+ *  returns data that has been checked, and at the first invalid byte, reading stops as if
+ *  the file ended there; getInvalidUTF8Offset() returns where that was.
+ *
+ *  The constructor and read() throw FSException on errors.
+ */
+class ChunkedFile : public ProhibitCopy
+{
+    string      _strFilename;
+    int         _fd = -1;
+    string      _strBuffer;
+    size_t      _ofsData = 0;
+    size_t      _cbData = 0;
+    bool        _fEOF = false;
+
+    bool        _fCheckUTF8;
+    size_t      _cbChecked = 0;                     // Checked part of the data.
+    size_t      _ofsInFile = 0;                     // File offset of the data.
+    size_t      _ofsInvalidUTF8 = string_view::npos;
+
+    void checkUTF8();
+
+public:
+    ChunkedFile(const string &strFilename,
+                size_t cbBuffer,
+                bool fCheckUTF8 = false);
+    ~ChunkedFile();
+
+    /**
+     *  Returns the data that has been read but not consumed yet. This stays valid
+     *  until the next call to read().
+     */
+    string_view view() const
+    {
+        return string_view(_strBuffer.data() + _ofsData, (_fCheckUTF8) ? _cbChecked : _cbData);
+    }
+
+    /**
+     *  Returns the file offset of the first byte that is not valid UTF-8, or npos if
+     *  there was none so far or the data is not being checked.
+     */
+    size_t getInvalidUTF8Offset() const
+    {
+        return _ofsInvalidUTF8;
+    }
+
+    const string& getFilename() const
+    {
+        return _strFilename;
+    }
+
+    size_t capacity() const
+    {
+        return _strBuffer.size();
+    }
+
+    bool eof() const
+    {
+        return _fEOF;
+    }
+
+    void consume(size_t cb);
+
+    size_t read();
+};
+
+} // namespace XWP
+
+#endif // XWP_CHUNKEDFILE_H
@@ -82,6 +82,20 @@ public:
     static void SetProgramName(const char *pcsz);
 };
 
+/**
+ *  While an instance exists, everything that Debug logs on the current thread is
+ *  appended to the given string instead of being printed. This allows worker threads
+ *  to collect their messages so that the caller can print them in a defined order.
+ */
+class DebugCapture : public ProhibitCopy
+{
+    string  *_pstrPrevious;
+
+public:
+    DebugCapture(string &strTarget);
+    ~DebugCapture();
+};
+
 } // namespace XWP
 
 #endif // XWP_STRINGHELP_H
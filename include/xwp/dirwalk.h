@@ -0,0 +1,62 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#ifndef XWP_DIRWALK_H
+#define XWP_DIRWALK_H
+
+#include "xwp/basetypes.h"
+
+namespace XWP
+{
+
+/***************************************************************************
+ *
+ *  FileFinder
+ *
+ **************************************************************************/
+
+/**
+ *  In-process replacement for "find -L <dir> -name <glob>".
+ *
+ *  The directory trees are read by several threads, which share a queue of
+ *  directories that still need to be read. Excluded directories are pruned
+ *  before they are opened, and the d_type field from readdir() is used so that
+ *  only symlinks and entries of unknown type need a stat() call.
+ *
+ *  Symlinks are followed like with find -L. A directory that turns out to be its
+ *  own ancestor (a symlink loop) is not entered again, and a file that can be
+ *  reached under several names is only reported once: preferably under a name
+ *  that does not go through a symlink, otherwise under the alphabetically first.
+ *
+ *  Globs are fnmatch() patterns. Include globs are matched against file names.
+ *  Exclude globs are matched against the names of files and directories, or
+ *  against the path relative to the root if they contain a slash.
+ */
+class FileFinder : public ProhibitCopy
+{
+    struct Impl;
+    Impl    *_pImpl;
+
+public:
+    FileFinder();
+    ~FileFinder();
+
+    void addInclude(const string &strGlob);
+    void addExclude(const string &strGlob);
+
+    void setThreads(unsigned int cThreads);
+
+    void run(const StringVector &vRoots,
+             StringVector &vFiles);
+};
+
+} // namespace XWP
+
+#endif // XWP_DIRWALK_H
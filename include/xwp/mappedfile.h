@@ -0,0 +1,67 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#ifndef XWP_MAPPEDFILE_H
+#define XWP_MAPPEDFILE_H
+
+#include "xwp/basetypes.h"
+
+#include <memory>
+
+namespace XWP
+{
+
+/***************************************************************************
+ *
+ *  MappedFile
+ *
+ **************************************************************************/
+
+/**
+ *  Read-only access to the entire contents of a file. Large files are mmap()ed;
+ *  smaller ones are read into a heap buffer with a single read(), which is cheaper
+ *  than setting up a mapping for them.
+ *
+ *  The constructor throws FSException if the file cannot be opened or read. The
+ *  data stays valid for the lifetime of the instance.
+ */
+class MappedFile : public ProhibitCopy
+{
+    const char  *_p = NULL;
+    size_t      _cb = 0;
+    bool        _fMapped = false;
+    string      _strBuffer;
+
+public:
+    MappedFile(const string &strFilename);
+    ~MappedFile();
+
+    const char* data() const
+    {
+        return _p;
+    }
+
+    size_t size() const
+    {
+        return _cb;
+    }
+
+    string_view view() const
+    {
+        return string_view(_p, _cb);
+    }
+
+    void assign(string &&str);
+};
+typedef std::shared_ptr<MappedFile> PMappedFile;
+
+} // namespace XWP
+
+#endif // XWP_MAPPEDFILE_H
@@ -14,26 +14,91 @@
 #include "xwp/basetypes.h"
 
 #include <functional>
+#include <type_traits>
 
 class Regex;
 
+/**
+ *  Receives the results of Regex::matches().
+ *
+ *  This only records the offsets of the whole match and of the captures in the haystack.
+ *  view() returns a capture as a string_view into the haystack without copying anything,
+ *  so the haystack must outlive the views and all calls to view() and get(). get() makes
+ *  a string copy of a capture on demand and keeps it until the next match; the buffers are
+ *  reused from one match to the next, so repeated matches with the same RegexMatches do
+ *  not normally allocate.
+ *
+ *  If a match fails, the RegexMatches keeps the results of the previous match.
+ */
 class RegexMatches
 {
     friend class Regex;
-    StringVector v;
+    friend class RegexSet;
+    string_view         _svHaystack;
+    vector<size_t>      _vOffsets;          // First and last offset of every capture, string_view::npos if unset.
+    StringVector        _vStrings;          // Copies made by get(), as flagged in _vfCopied.
+    vector<bool>        _vfCopied;
     const Regex *pRE = NULL;
 
+    void reset(string_view svHaystack,
+               size_t cCaptures);
+
 public:
+    string_view view(uint u) const;
+
     const string& get(uint u);
 
-    size_t size()
+    size_t size() const
     {
-        return v.size() ? v.size() - 1 : 0;
+        return _vOffsets.size() ? _vOffsets.size() / 2 - 1 : 0;
     }
 };
 
 /**
- *  An easy to use class for regular expressions, using the PCRE library.
+ *  A replacement string for Regex::findReplace(), split once into literal pieces and $1-like
+ *  backreferences so that every match only appends the pieces to the output.
+ *
+ *  Only $1 to $9 are backreferences; a $ followed by anything else, including $0, is copied
+ *  literally. A backreference to a capture that is not set is replaced with nothing.
+ *
+ *  If the same replacement is used many times, keep a RegexReplacement next to the Regex
+ *  instead of passing the string to findReplace() every time.
+ */
+class RegexReplacement
+{
+    friend class Regex;
+
+    struct Piece
+    {
+        size_t  ofs;                // Literal: offset into _str.
+        size_t  len;                // Literal: length.
+        int     iCapture;           // Backreference number, or -1 for a literal.
+    };
+
+    string          _str;
+    vector<Piece>   _vPieces;
+    int             _maxCapture = 0;
+
+    void appendTo(string &strOut,
+                  const RegexMatches &aMatches) const;
+
+public:
+    RegexReplacement() { }
+    explicit RegexReplacement(const string &str);
+
+    int getMaxCapture() const
+    {
+        return _maxCapture;
+    }
+
+    const string& toString() const
+    {
+        return _str;
+    }
+};
+
+/**
+ *  An easy to use class for regular expressions, using the PCRE2 library.
  *
  *  I tried using C++11's regexen but ditched them for two reasons:
  *
@@ -45,7 +110,7 @@ public:
  *      finishes in one second. Go figure.
  *
  *  A Regex instance is a compiled regular expression. The regexen themselves support the whole
- *  Perl syntax, as supported by PCRE. Three useful Perl features are supported on top of that:
+ *  Perl syntax, as supported by PCRE2. Three useful Perl features are supported on top of that:
  *
  *   --  You can use two variants of matches() for simple tests or to capture substrings.
  *
@@ -60,41 +125,198 @@ public:
  *    RegexMatch aMatches;
  *    if (re.matches("test123", aMatches))
  *        const string &str = aMatches.get(1); ...
+ *
+ *  Thread safety: all const methods can be called on the same Regex from any number of threads
+ *  at the same time, which is what makes the static instances above usable from the parser
+ *  threads. A compiled regex is never modified after the constructor; the match data and the
+ *  JIT stack that PCRE2 needs for every match are kept per thread (see RegexThreadData in
+ *  regex.cpp). The same goes for RegexReplacement and RegexSet. A RegexMatches, on the other
+ *  hand, belongs to the thread that passes it to matches(). Constructing and destroying a
+ *  Regex is thread-safe as well, but a Regex must of course not be destroyed while another
+ *  thread is using it.
  */
 class Regex
 {
 private:
+    friend class RegexSet;
+
     class Impl;
     Impl    *_pImpl;
 
+    /**
+     *  Implementation for the findReplace() variants. For every match, this calls
+     *  fnAppend(string &strNew, const RegexMatches &aMatches), which appends the
+     *  replacement to strNew.
+     *
+     *  The new string is built by appending the text between the matches and the
+     *  replacements to a buffer that is sized for the haystack up front, and then
+     *  swapped in.
+     */
+    template<typename FnAppend>
     size_t findReplaceImpl(string &strHaystack,
-                           std::function<void (const StringVector &vMatches, string &strReplace)> fnMatch,
-                           bool fGlobal) const;
+                           FnAppend fnAppend,
+                           bool fGlobal) const
+    {
+        size_t cReplacements = 0;
+        string strNew;
+        size_t lastlast = 0;
+        size_t ofs = 0;
+        RegexMatches aMatches;
+        /*
+         *  Example: in
+         *      FOO.FOO.FOO.REST
+         *      0123456789012345
+         *  replace /FOO/ with BAR.
+         *  On the first call, we get first = 0, last = 3.
+         *  On the second, we get     first = 4, last = 7.
+         *
+         *  matches() leaves the end of the last capture that was set in ofs; as with
+         *  split(), an end of 0 counts as no match.
+         */
+        while (    (matches(strHaystack, aMatches, ofs))
+                && (ofs)
+              )
+        {
+            size_t first0 = aMatches._vOffsets[0];
+            if (cReplacements == 0)
+            {
+                // First call:
+                strNew.reserve(strHaystack.length() + strHaystack.length() / 4);
+                strNew.append(strHaystack, 0, first0);
+            }
+            else
+                // Subsequent calls:
+                if (first0 > lastlast)
+                    strNew.append(strHaystack, lastlast, first0 - lastlast);
+
+            fnAppend(strNew, (const RegexMatches&)aMatches);
+
+            lastlast = aMatches._vOffsets[1];
+
+            // Search again in the haystack after the whole match.
+            ++ofs;
+
+            ++cReplacements;
+
+            if (!fGlobal)
+                break;
+        }
+
+        if (cReplacements)
+        {
+            if (lastlast)
+                strNew.append(strHaystack, lastlast, string::npos);
+
+            strHaystack.swap(strNew);
+        }
+
+        return cReplacements;
+    }
+
 public:
     Regex(const string &strRE);
     ~Regex();
 
     static int GetMaxCapture(const string &strReplace);
 
-    bool matches(const string &strHaystack) const;
-    bool matches(const string &strHaystack,
+    bool matches(string_view strHaystack) const;
+    bool matches(string_view strHaystack,
                  RegexMatches &aMatches) const;
-    bool matches(const string &strHaystack,
+    bool matches(string_view strHaystack,
                  RegexMatches &aMatches,
                  size_t &ofs) const;
 
     size_t findReplace(string &strHaystack,
                        const string &strReplace,
                        bool fGlobal) const;
+    size_t findReplace(string &strHaystack,
+                       const RegexReplacement &replacement,
+                       bool fGlobal) const;
     size_t findReplace(string &strHaystack,
                        std::function<void (const StringVector &vMatches, string &strReplace)> fnMatch,
                        bool fGlobal) const;
 
+    /**
+     *  Like the other findReplace() variants, but calls fnMatch for every match, which
+     *  must set the replacement from the match:
+     *
+     *      re.findReplace(str,
+     *                     [](const RegexMatches &aMatches, string &strReplace)
+     *                     {
+     *                         strReplace = lookup(aMatches.view(1));
+     *                     },
+     *                     true);
+     *
+     *  aMatches.view() returns the captures without copying them. The replacement can
+     *  again have $1-like backreferences. Since this is a template, the callback gets
+     *  inlined.
+     */
+    template<typename Fn,
+             typename = std::enable_if_t<std::is_invocable_v<Fn&, const RegexMatches&, string&>>>
+    size_t findReplace(string &strHaystack,
+                       Fn &&fnMatch,
+                       bool fGlobal) const
+    {
+        string strReplace;
+        return findReplaceImpl(strHaystack,
+                               [&fnMatch, &strReplace](string &strNew, const RegexMatches &aMatches)
+                               {
+                                   strReplace.clear();
+                                   fnMatch(aMatches, strReplace);
+                                   // Only parse the replacement if it can have backreferences.
+                                   if (strReplace.find('$') == string::npos)
+                                       strNew += strReplace;
+                                   else
+                                       RegexReplacement(strReplace).appendTo(strNew, aMatches);
+                               },
+                               fGlobal);
+    }
+
     void split(const string &strHaystack, StringVector &sv) const;
 
     const string& toString() const;
 
-    bool findInFile(const string &strFilename, RegexMatches &aMatches);
+#ifdef XWP_REGEX_STATS
+    static void EnableStats();
+    static void DumpStats();
+#endif
+};
+
+/**
+ *  A list of regexen that are matched against a string in one pass, to replace a chain
+ *  like
+ *
+ *      if (re1.matches(str, aMatches)) ...
+ *      else if (re2.matches(str, aMatches)) ...
+ *
+ *  The patterns are compiled into a single alternation, in which every pattern becomes
+ *  a capturing group of its own. matches() returns the index of the pattern that matched
+ *  and fills the RegexMatches as if that pattern had been matched alone, so get(1) is the
+ *  first capture of that pattern.
+ *
+ *  As with any alternation, the match that starts leftmost in the string wins; of the
+ *  patterns that match at the same position, the first in the list wins. For patterns
+ *  that are anchored with ^, that is the same as trying them in order. Since the captures
+ *  get renumbered, the patterns must not use numbered backreferences like \1.
+ */
+class RegexSet
+{
+    vector<uint32_t>    _vGroups;           // For each pattern, the number of the group that wraps it.
+    vector<uint32_t>    _vCaptures;         // For each pattern, the number of its own captures.
+    Regex               _re;                // Must come after the above, see combine().
+
+    string combine(const StringVector &vPatterns);
+
+public:
+    RegexSet(const StringVector &vPatterns);
+
+    int matches(string_view strHaystack,
+                RegexMatches &aMatches) const;
+
+    size_t size() const
+    {
+        return _vGroups.size();
+    }
 };
 
 #endif
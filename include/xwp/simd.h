@@ -0,0 +1,61 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#ifndef XWP_SIMD_H
+#define XWP_SIMD_H
+
+#include "xwp/basetypes.h"
+
+namespace XWP
+{
+
+/*
+ *  Vectorized byte searches for scanning large buffers.
+ *
+ *  On x86 these use AVX2 if the CPU has it and SSE2 otherwise; the choice is made once at
+ *  run time. Other platforms get plain loops. All of them return the same results.
+ */
+
+/**
+ *  Returns the offset of the first byte in sv that is one of the (at most eight) bytes in
+ *  svSet, or string_view::npos.
+ *
+ *  In addition, cNewlines receives the number of newlines before that byte (or in all of sv),
+ *  and ofsLineStart the offset just after the last of those newlines, or 0 if there was none.
+ */
+size_t findFirstOfCountingLines(string_view sv,
+                                string_view svSet,
+                                size_t &cNewlines,
+                                size_t &ofsLineStart);
+
+/**
+ *  Like string_view::find(), but compares 16 or 32 positions at a time.
+ */
+size_t findString(string_view svHaystack,
+                  string_view svNeedle);
+
+/**
+ *  Returns the offset of the first byte in sv that does not belong to a valid UTF-8 sequence,
+ *  or string_view::npos if all of sv is valid UTF-8. Overlong forms, surrogates, code points
+ *  above U+10FFFF and sequences cut off at the end of sv are invalid.
+ *
+ *  ASCII is skipped 16 or 32 bytes at a time; only the other sequences are decoded one by one.
+ */
+size_t findInvalidUTF8(string_view sv);
+
+/**
+ *  Returns the length of the valid UTF-8 sequence at the start of sv (between 1 and 4), or
+ *  0 if there is none.
+ */
+size_t getUTF8SequenceLength(string_view sv);
+
+} // namespace XWP
+
+#endif // XWP_SIMD_H
@@ -24,7 +24,7 @@ namespace XWP
 {
 
 void trim(string &s);
-string trimmed(const string &s);
+string trimmed(string_view sv);
 
 StringSet explodeSet(const string &str,
                      const string &strDelimiter,
@@ -50,6 +50,8 @@ string toHTML2(const string &str);
 void toLaTeX(string &ls, bool fInPRE);
 string toLaTeX2(const string &ls, bool fInPRE);
 
+string makeValidUTF8(string_view sv);
+
 void stringReplace(string &subject,
                    const string &search,
                    const string &replace);
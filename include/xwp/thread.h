@@ -13,6 +13,7 @@
 
 #include <mutex>
 #include <atomic>
+#include <functional>
 
 #include "xwp/basetypes.h"
 
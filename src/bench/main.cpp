@@ -0,0 +1,287 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+/*
+ *  xwp-bench: microbenchmarks for the regex and string helpers that phoxygen spends its
+ *  time in. Every benchmark runs one operation over a realistic doc comment until at least
+ *  the minimum time has passed and prints one tab-separated line:
+ *
+ *      name    iterations    ns/op    bytes/s
+ *
+ *  Lines starting with # are comments. Usage:
+ *
+ *      xwp-bench [--filter=SUBSTRING] [--time=MILLISECONDS]
+ */
+
+#define DEF_STRING_IMPLEMENTATION
+
+#include "xwp/regex.h"
+#include "xwp/except.h"
+#include "xwp/stringhelp.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+/***************************************************************************
+ *
+ *  Input
+ *
+ **************************************************************************/
+
+/**
+ *  A doc comment of the kind that phoxygen formats, with all the markup that the formatter
+ *  looks for. It is repeated to make the input of every benchmark.
+ */
+const string g_strComment = R"i____(/**
+ *  Loads the ticket with the given ID from the database and returns it, or throws
+ *  a DrnException if there is no such ticket or the current user has no `READ` access.
+ *
+ *  Tickets are cached per request, so calling this twice with the same ID is cheap.
+ *  See \ref Ticket::FindManyByIDs() for loading several at once, and \ref ticket_states
+ *  for what the <b>status</b> field can contain.
+ *
+ *  Steps:
+ *
+ *   1) Look up the ID in the cache of TicketBase instances;
+ *
+ *   2) otherwise, run the SELECT on the tickets table and create a Ticket from the row.
+ *
+ *  This is also what the GET /ticket REST API calls, with `$fRequireAccess = TRUE`.
+ *
+ *  @param int $idTicket         Primary index of the ticket to load.
+ *  @param bool $fRequireAccess  If TRUE (the default), access is checked for the current user.
+ *  @return Ticket
+ */
+)i____";
+
+const size_t C_REPEATS = 16;
+
+/***************************************************************************
+ *
+ *  Benchmark driver
+ *
+ **************************************************************************/
+
+string  g_strFilter;
+double  g_dMinTime = 0.2;           // Seconds.
+
+// Results are added up here so that the compiler cannot drop the operations.
+volatile size_t g_uSink = 0;
+
+/**
+ *  Runs fnOp, which processes cbPerOp bytes and returns some number derived from its result,
+ *  often enough to take at least g_dMinTime seconds and prints the result line.
+ */
+template<typename Fn>
+void runBenchmark(const string &strName,
+                  size_t cbPerOp,
+                  Fn fnOp)
+{
+    if (    (!g_strFilter.empty())
+         && (strName.find(g_strFilter) == string::npos)
+       )
+        return;
+
+    // Warm up caches and buffers once.
+    g_uSink += fnOp();
+
+    size_t cIterations = 1;
+    double dSeconds = 0;
+    while (true)
+    {
+        auto t1 = std::chrono::steady_clock::now();
+        size_t u = 0;
+        for (size_t i = 0;
+             i < cIterations;
+             ++i)
+            u += fnOp();
+        auto t2 = std::chrono::steady_clock::now();
+        g_uSink += u;
+
+        dSeconds = std::chrono::duration<double>(t2 - t1).count();
+        if (dSeconds >= g_dMinTime)
+            break;
+        cIterations *= 2;
+    }
+
+    double dNsPerOp = dSeconds * 1e9 / cIterations;
+    double dBytesPerSecond = (double)cbPerOp * cIterations / dSeconds;
+    printf("%s\t%zu\t%.1f\t%.0f\n",
+           strName.c_str(),
+           cIterations,
+           dNsPerOp,
+           dBytesPerSecond);
+    fflush(stdout);
+}
+
+/***************************************************************************
+ *
+ *  Benchmarks
+ *
+ **************************************************************************/
+
+void benchRegex(const string &strText,
+                const StringVector &vLines)
+{
+    size_t cb = strText.length();
+
+    // Line-by-line tests as in CommentBase::formatComment().
+    static const Regex s_reEmptyLine(R"i____(^\s*$)i____");
+    runBenchmark("Regex::matches/no-captures", cb, [&]()
+    {
+        size_t c = 0;
+        for (const auto &strLine : vLines)
+            c += s_reEmptyLine.matches(strLine);
+        return c;
+    });
+
+    static const Regex s_reParam(R"i____(^\s*\*?\s*@param\s+(\S+)\s+(\$\S+)\s*(.*))i____");
+    runBenchmark("Regex::matches/captures", cb, [&]()
+    {
+        size_t c = 0;
+        RegexMatches aMatches;
+        for (const auto &strLine : vLines)
+            if (s_reParam.matches(strLine, aMatches))
+                c += aMatches.view(2).length();
+        return c;
+    });
+
+    static const Regex s_reLiteral("REST API");
+    runBenchmark("Regex::matches/literal", cb, [&]()
+    {
+        size_t c = 0;
+        for (const auto &strLine : vLines)
+            c += s_reLiteral.matches(strLine);
+        return c;
+    });
+
+    // The replacements copy the text first, as the formatter works on copies too.
+    static const Regex s_reCode("`([^`]+)`");
+    static const RegexReplacement s_replLiteral("<code></code>");
+    runBenchmark("Regex::findReplace/literal", cb, [&]()
+    {
+        string str(strText);
+        return s_reCode.findReplace(str, s_replLiteral, true);
+    });
+
+    static const RegexReplacement s_replBackref("<code>$1</code>");
+    runBenchmark("Regex::findReplace/backref", cb, [&]()
+    {
+        string str(strText);
+        return s_reCode.findReplace(str, s_replBackref, true);
+    });
+
+    // split() is only used on "implements" lists in the parser, so that is the input here.
+    static const Regex s_reSplitComma(R"i____(\s*,\s*)i____");
+    static const string s_strImplements = "Countable, ArrayAccess, IteratorAggregate, JsonSerializable";
+    runBenchmark("Regex::split", s_strImplements.length(), [&]()
+    {
+        StringVector v;
+        s_reSplitComma.split(s_strImplements, v);
+        return v.size();
+    });
+}
+
+void benchStrings(const string &strText,
+                  const StringVector &vLines)
+{
+    size_t cb = strText.length();
+
+    runBenchmark("stringReplace", cb, [&]()
+    {
+        string str(strText);
+        stringReplace(str, "\\ref", "@ref");
+        return str.length();
+    });
+
+    runBenchmark("toHTML", cb, [&]()
+    {
+        string str(strText);
+        toHTML(str);
+        return str.length();
+    });
+
+    runBenchmark("toLaTeX", cb, [&]()
+    {
+        string str(strText);
+        toLaTeX(str, false);
+        return str.length();
+    });
+
+    runBenchmark("explodeVector", cb, [&]()
+    {
+        return explodeVector(strText, "\n").size();
+    });
+
+    runBenchmark("implode", cb, [&]()
+    {
+        return implode("\n", vLines).length();
+    });
+}
+
+/**
+ *  Returns the number after the "=" of an option like --time=N, which must be a positive
+ *  integer below a billion, or throws FSException.
+ */
+unsigned int parseCount(const string &strArg)
+{
+    string strValue = strArg.substr(strArg.find('=') + 1);
+    unsigned long ul = 0;
+    if (    (!strValue.empty())
+         && (strValue.find_first_not_of("0123456789") == string::npos)
+         && (strValue.length() <= 9)
+       )
+        ul = strtoul(strValue.c_str(), nullptr, 10);
+    if (ul < 1)
+        throw FSException("invalid number " + quote(strValue) + " in argument " + strArg + "; must be a positive integer");
+    return (unsigned int)ul;
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        for (int i = 1;
+             i < argc;
+             ++i)
+        {
+            string strArg(argv[i]);
+            if (startsWith(strArg, "--filter="))
+                g_strFilter = strArg.substr(9);
+            else if (startsWith(strArg, "--time="))
+                g_dMinTime = parseCount(strArg) / 1000.0;
+            else
+                throw FSException("don't know what to do with argument " + strArg);
+        }
+    }
+    catch (FSException &e)
+    {
+        fprintf(stderr,
+                "xwp-bench: %s\n"
+                "Usage: xwp-bench [--filter=SUBSTRING] [--time=MILLISECONDS]\n",
+                e.what());
+        return 2;
+    }
+
+    string strText;
+    strText.reserve(g_strComment.length() * C_REPEATS);
+    for (size_t i = 0;
+         i < C_REPEATS;
+         ++i)
+        strText += g_strComment;
+    StringVector vLines = explodeVector(strText, "\n", false, true);
+
+    printf("# input: %zu bytes, %zu lines\n", strText.length(), vLines.size());
+    printf("# name\titerations\tns/op\tbytes/s\n");
+
+    benchRegex(strText, vLines);
+    benchStrings(strText, vLines);
+}
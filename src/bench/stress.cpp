@@ -0,0 +1,260 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+/*
+ *  xwp-stress: checks that shared Regex, RegexReplacement and RegexSet instances can be
+ *  used from many threads at once, as the Regex class comment promises. Every thread runs
+ *  the same matches, replacements and splits on the same static instances, some of them
+ *  nested in findReplace() callbacks, and compares its results with a single-threaded run.
+ *  Every round also constructs and destroys a regex of its own.
+ *
+ *  Prints one summary line and exits with 1 if any result differed. Usage:
+ *
+ *      xwp-stress [--threads=N] [--rounds=N]
+ *
+ *  Build with XWP_REGEX_STATS defined to include the statistics counters, and run under
+ *  ThreadSanitizer to catch races that do not change the results.
+ */
+
+#define DEF_STRING_IMPLEMENTATION
+
+#include "xwp/regex.h"
+#include "xwp/except.h"
+#include "xwp/stringhelp.h"
+
+#include <atomic>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+
+/***************************************************************************
+ *
+ *  Input
+ *
+ **************************************************************************/
+
+/**
+ *  Lines of the kind that the parser and the formatter see: declarations, doc comment
+ *  markup and some text outside of ASCII, so that the UTF-8 handling is involved too.
+ */
+const string g_strInput = R"i____(/**
+ *  Loads the ticket with the given ID and returns it, or throws a DrnException if there is
+ *  no such ticket or the current user has no `READ` access. See \ref Ticket::FindManyByIDs().
+ *
+ *  Größe und Länge: the <b>status</b> field is “open” or “closed” — see \ref ticket_states.
+ *
+ *  This is also what the GET /ticket REST API calls, with `$fRequireAccess = TRUE`.
+ *
+ *  @param int $idTicket         Primary index of the ticket to load.
+ *  @param bool $fRequireAccess  If TRUE (the default), access is checked.
+ *  @return Ticket
+ */
+abstract class TicketBase implements Countable, ArrayAccess, JsonSerializable
+interface TicketSource
+    public static function FindByID($idTicket, $fRequireAccess = TRUE)
+CREATE TABLE IF NOT EXISTS tickets
+$app::Get('/ticket/:id', function ($idTicket)
+
+)i____";
+
+/***************************************************************************
+ *
+ *  Checks
+ *
+ **************************************************************************/
+
+/**
+ *  Runs every check over all lines and appends one result string per check to vResults.
+ *  This is what every thread does in every round, so everything in here must only use
+ *  the shared instances through their const methods.
+ */
+void runChecks(const StringVector &vLines,
+               StringVector &vResults)
+{
+    // Anchored literal prefix, literal without PCRE, and the plain PCRE paths.
+    static const Regex s_reEmptyLine(R"i____(^\s*$)i____");
+    static const Regex s_reReturn(R"i____(^ \*  @return\s+(\S+))i____");
+    static const Regex s_reLiteral("REST API");
+    static const Regex s_reParam(R"i____(^\s*\*?\s*@param\s+(\S+)\s+(\$\S+)\s*(.*))i____");
+
+    static const Regex s_reCode("`([^`]+)`");
+    static const RegexReplacement s_replCode("<code>$1</code>");
+    static const Regex s_reRef(R"i____(\\ref\s+([A-Za-z0-9_:]+(?:\(\))?))i____");
+    static const Regex s_reWord(R"i____(([A-Z][a-z]+))i____");
+    static const Regex s_reUmlaut("([äöüß])");
+    static const Regex s_reSplitComma(R"i____(\s*,\s*)i____");
+    static const Regex s_reImplements(R"i____(\s+implements\s+(.*))i____");
+
+    static const RegexSet s_reDeclarations(
+        {
+            R"i____(^\s*((?:abstract\s+)?class)\s+(\S+).*)i____",
+            R"i____(^\s*(interface)\s+(\S+))i____",
+            R"i____(^(?:.*?\s)?(?:public\s+|private\s+|protected\s+|static\s+)*function\s+([A-Za-z0-9_]+)\s*\((.*))i____",
+            R"i____(^\s*CREATE\s+TABLE\s+(?:IF\s+NOT\s+EXISTS\s+)?([A-Za-z_]+).*)i____",
+            R"i____(^\s*\S+::(Get|Post|Put|Delete)\(["'"](.*)["'"],(.*))i____"
+        });
+
+    RegexMatches aMatches;
+    for (const auto &strLine : vLines)
+    {
+        string str = to_string(s_reEmptyLine.matches(strLine))
+                   + to_string(s_reLiteral.matches(strLine));
+
+        if (s_reReturn.matches(strLine, aMatches))
+            str += "|return " + aMatches.get(1);
+
+        if (s_reParam.matches(strLine, aMatches))
+            str += "|param " + string(aMatches.view(1)) + " " + string(aMatches.view(2)) + " " + string(aMatches.view(3));
+
+        int iDecl = s_reDeclarations.matches(strLine, aMatches);
+        str += "|decl " + to_string(iDecl);
+        if (iDecl >= 0)
+            for (size_t u = 1;
+                 u <= aMatches.size();
+                 ++u)
+                str += " " + string(aMatches.view(u));
+
+        vResults.push_back(str);
+
+        string strCopy(strLine);
+        s_reCode.findReplace(strCopy, s_replCode, true);
+        s_reUmlaut.findReplace(strCopy, "[$1]", true);
+
+        // A callback that matches other shared regexen while the outer match is in progress,
+        // as the formatter does when it linkifies references.
+        s_reRef.findReplace(strCopy,
+                            [](const RegexMatches &aRef, string &strReplace)
+                            {
+                                string strTarget(aRef.view(1));
+                                s_reWord.findReplace(strTarget, "<$1>", true);
+                                RegexMatches aInner;
+                                if (s_reWord.matches(strTarget, aInner))
+                                    strTarget += "=" + string(aInner.view(1));
+                                strReplace = "@ref(" + strTarget + ")";
+                            },
+                            true);
+        vResults.push_back(strCopy);
+
+        if (s_reImplements.matches(strLine, aMatches))
+        {
+            StringVector v;
+            s_reSplitComma.split(aMatches.get(1), v);
+            vResults.push_back(implode("/", v));
+        }
+    }
+
+    // A regex of this round's own, constructed while the other threads do the same.
+    Regex reTicket("Ticket(\\w*)");
+    string strAll = implode("\n", vLines);
+    vResults.push_back(to_string(reTicket.findReplace(strAll, "T[$1]", true)) + " " + to_string(strAll.length()));
+}
+
+/***************************************************************************
+ *
+ *  Main
+ *
+ **************************************************************************/
+
+/**
+ *  Returns the number after the "=" of an option like --threads=N, which must be a positive
+ *  integer below a billion, or throws FSException.
+ */
+unsigned int parseCount(const string &strArg)
+{
+    string strValue = strArg.substr(strArg.find('=') + 1);
+    unsigned long ul = 0;
+    if (    (!strValue.empty())
+         && (strValue.find_first_not_of("0123456789") == string::npos)
+         && (strValue.length() <= 9)
+       )
+        ul = strtoul(strValue.c_str(), nullptr, 10);
+    if (ul < 1)
+        throw FSException("invalid number " + quote(strValue) + " in argument " + strArg + "; must be a positive integer");
+    return (unsigned int)ul;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int cThreads = 8;
+    unsigned int cRounds = 200;
+
+    try
+    {
+        for (int i = 1;
+             i < argc;
+             ++i)
+        {
+            string strArg(argv[i]);
+            if (startsWith(strArg, "--threads="))
+                cThreads = parseCount(strArg);
+            else if (startsWith(strArg, "--rounds="))
+                cRounds = parseCount(strArg);
+            else
+                throw FSException("don't know what to do with argument " + strArg);
+        }
+    }
+    catch (FSException &e)
+    {
+        fprintf(stderr,
+                "xwp-stress: %s\n"
+                "Usage: xwp-stress [--threads=N] [--rounds=N]\n",
+                e.what());
+        return 2;
+    }
+
+#ifdef XWP_REGEX_STATS
+    Regex::EnableStats();
+#endif
+
+    StringVector vLines = explodeVector(g_strInput, "\n", false, true);
+
+    // The static regexen get constructed by the first call, before the threads start, as
+    // they would be in phoxygen. The round-local one is constructed concurrently.
+    StringVector vExpected;
+    runChecks(vLines, vExpected);
+
+    std::atomic<size_t> cMismatches(0);
+    std::atomic<size_t> cChecks(0);
+    vector<std::thread> vThreads;
+    for (unsigned int t = 0;
+         t < cThreads;
+         ++t)
+        vThreads.push_back(std::thread([&]()
+        {
+            for (unsigned int r = 0;
+                 r < cRounds;
+                 ++r)
+            {
+                StringVector vResults;
+                runChecks(vLines, vResults);
+                cChecks += vResults.size();
+                if (vResults != vExpected)
+                {
+                    size_t c = (vResults.size() == vExpected.size()) ? 0 : 1;
+                    for (size_t u = 0;
+                         u < std::min(vResults.size(), vExpected.size());
+                         ++u)
+                        if (vResults[u] != vExpected[u])
+                            ++c;
+                    cMismatches += c;
+                }
+            }
+        }));
+    for (auto &t : vThreads)
+        t.join();
+
+    printf("%u threads, %u rounds, %zu results, %zu mismatches\n",
+           cThreads,
+           cRounds,
+           cChecks.load(),
+           cMismatches.load());
+
+    return (cMismatches) ? 1 : 0;
+}
@@ -9,51 +9,89 @@
  */
 
 #include "phoxygen/phoxygen.h"
+#include "phoxygen/scanner.h"
+
+#include <algorithm>
+#include <unordered_map>
 
 ClassesMap g_mapClasses;
 
+// The classes from g_mapClasses whose names LinkifyClasses() looks up in the text, and
+// the others, for which it has to run their regexen; see IsPlainName().
+unordered_map<string, ClassComment*> g_mapPlainClassNames;
+ClassesMap g_mapOtherClassNames;
+
+/**
+ *  Returns true if the class name consists of identifier characters only, as all PHP
+ *  class names do. LinkifyClasses() can find those by looking at the words of the text.
+ */
+static bool IsPlainName(const string &strIdentifier)
+{
+    for (char c : strIdentifier)
+        if (!isIdentifierChar(c))
+            return false;
+    return !strIdentifier.empty();
+}
+
 ClassComment::ClassComment(const string &strKeyword,
                            const string &strIdentifier,
-                           const string &strComment,
+                           const CommentText &comment,
                            const string &strInputFile,
                            int linenoFirst,
                            int linenoLast)
     : CommentBase(Type::CLASS,
                   strKeyword,
                   strIdentifier,
-                  strComment,
+                  comment,
                   strInputFile,
                   linenoFirst,
                   linenoLast,
                   "class_" + strIdentifier),
-      _reClassHTML("(^|p>|\\s)" + strIdentifier + "($|\\s|[.,!;])"),
-      _reClassLaTeX("(^|\\s)" + strIdentifier + "($|\\s|[.,!;])"),
-      _strReplSelfHTML("$1<b>" + strIdentifier + "</b>$2"),
-      _strReplOtherHTML("$1<a href=\"" + _strTargetHTML + "\">" + strIdentifier + "</a>$2")
+      _strSelfHTML("<b>" + strIdentifier + "</b>"),
+      _strOtherHTML("<a href=\"" + _strTargetHTML + "\">" + strIdentifier + "</a>"),
+      _strOtherLaTeX(FormatterLatex::MakeLink(_strTargetLaTeX, _identifier))
 {
-    auto fmt = FormatterBase::Get(OutputMode::LATEX);
-    _strReplOtherLaTeX = "$1" + FormatterLatex::MakeLink(_strTargetLaTeX,
-                                                         _identifier) + "$2";
+    if (!IsPlainName(strIdentifier))
+    {
+        _pReClassHTML = make_unique<Regex>("(^|p>|\\s)" + strIdentifier + "($|\\s|[.,!;])");
+        _pReClassLaTeX = make_unique<Regex>("(^|\\s)" + strIdentifier + "($|\\s|[.,!;])");
+    }
 }
 
 /* static */
 PClassComment ClassComment::Make(const string &strKeyword,
                                  const string &strIdentifier,
-                                 const string &strComment,
+                                 const CommentText &comment,
                                  const string &strInputFile,
                                  int linenoFirst,
                                  int linenoLast)
 {
     class Derived : public ClassComment { public: Derived(const string &strKeyword,
                                  const string &strIdentifier,
-                                 const string &strComment,
+                                 const CommentText &comment,
                                  const string &strInputFile,
                                  int linenoFirst,
-                                 int linenoLast) : ClassComment(strKeyword, strIdentifier, strComment, strInputFile, linenoFirst, linenoLast) {}
+                                 int linenoLast) : ClassComment(strKeyword, strIdentifier, comment, strInputFile, linenoFirst, linenoLast) {}
     };
-    auto p = make_shared<Derived>(strKeyword, strIdentifier, strComment, strInputFile, linenoFirst, linenoLast);
+    return make_shared<Derived>(strKeyword, strIdentifier, comment, strInputFile, linenoFirst, linenoLast);
+}
+
+/**
+ *  Adds the given class to the global list, which Find() and LinkifyClasses() use.
+ *  This is separate from Make() so that parsing can run on worker threads.
+ */
+/* static */
+void ClassComment::Add(PClassComment p)
+{
+    const string &strIdentifier = p->getIdentifier();
+    if (IsPlainName(strIdentifier))
+    {
+        g_mapPlainClassNames[strIdentifier] = p.get();
+        g_mapOtherClassNames.erase(strIdentifier);
+    }
+    else
+        g_mapOtherClassNames[strIdentifier] = p;
     g_mapClasses[strIdentifier] = p;
-    return p;
 }
 
 void ClassComment::addMember(PFunctionComment pMember)
@@ -96,17 +134,10 @@ string ClassComment::formatHierarchy(FormatterBase &fmt)
 
     auto pllParents = getParents();
     auto pllChildren = getChildren();
-    if (pllParents.size())
-    {
-        for (const string &strParent : pllParents)
-        {
-            auto pParent = ClassComment::Find(strParent);
-            if (pParent)
-                strFormatted += fmt.makeLink(pParent->getTarget(fmt),
-                                             NULL,
-                                             strParent) + fmt.mdash();
-        }
-    }
+    for (auto pParent : _vParentClasses)
+        strFormatted += fmt.makeLink(pParent->getTarget(fmt),
+                                     NULL,
+                                     pParent->getIdentifier()) + fmt.mdash();
 
     if (    (pllParents.size())
          || (pllChildren.size())
@@ -203,12 +234,127 @@ string ClassComment::makeLink(FormatterBase &fmt,
                         strDisplay);
 }
 
+/**
+ *  Returns true for the characters that \s matches in our regexen.
+ */
+static inline bool IsRegexSpace(char c)
+{
+    return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+/**
+ *  Replaces the names of all known classes in str with links to them, or in HTML, if
+ *  pstrSelf is given, the name of that class with bold text.
+ *
+ *  A class name is only replaced where it is a word of its own: at the start of str or
+ *  after whitespace (or "p>" in HTML), and at the end of str or before whitespace or one
+ *  of ".,!;". Since class names consist of identifier characters, such a name can only
+ *  be a whole word of the text, so instead of running a regex for every class over str,
+ *  this looks up every word that has those characters around it in g_mapPlainClassNames.
+ *  That is one pass over str no matter how many classes there are.
+ *
+ *  This gives the same result as findReplace() with the regex
+ *  (^|p>|\s)Name($|\s|[.,!;]) for every class, including that findReplace() goes on one
+ *  character after the end of a match, so that of "Foo, Foo" only the first Foo is
+ *  replaced. The few classes with other names still go through their regexen.
+ */
 /* static */
 void ClassComment::LinkifyClasses(FormatterBase &fmt,
                                   string &str,
                                   const string *pstrSelf)
 {
-    for (const auto &it : GetAll())
+    bool fHTML = (fmt.getMode() == OutputMode::HTML);
+
+    string strNew;
+    size_t ofsCopied = 0;
+    string strWord;
+    // For every class replaced so far, where findReplace() would look for the next match.
+    vector<pair<ClassComment*, size_t>> vRestarts;
+
+    size_t len = str.length();
+    size_t i = 0;
+    while (i < len)
+    {
+        if (!isIdentifierChar(str[i]))
+        {
+            ++i;
+            continue;
+        }
+
+        size_t ofsName = i;
+        while ((i < len) && (isIdentifierChar(str[i])))
+            ++i;
+
+        // Where the match would start, with the character before the name.
+        size_t ofsMatch;
+        if (ofsName == 0)
+            ofsMatch = 0;
+        else if (IsRegexSpace(str[ofsName - 1]))
+            ofsMatch = ofsName - 1;
+        else if (    (fHTML)
+                  && (ofsName >= 2)
+                  && (str[ofsName - 2] == 'p')
+                  && (str[ofsName - 1] == '>')
+                )
+            ofsMatch = ofsName - 2;
+        else
+            continue;
+
+        // Where findReplace() would go on after the match. $ also matches before a
+        // newline at the very end, and then the newline is not part of the match.
+        size_t ofsRestart;
+        if (i == len)
+            ofsRestart = len + 1;
+        else if ((i == len - 1) && (str[i] == '\n'))
+            ofsRestart = len;
+        else if (    (IsRegexSpace(str[i]))
+                  || (str[i] == '.')
+                  || (str[i] == ',')
+                  || (str[i] == '!')
+                  || (str[i] == ';')
+                )
+            ofsRestart = i + 2;
+        else
+            continue;
+
+        strWord.assign(str, ofsName, i - ofsName);
+        auto it = g_mapPlainClassNames.find(strWord);
+        if (it == g_mapPlainClassNames.end())
+            continue;
+        ClassComment *pClass = it->second;
+
+        auto itRestart = std::find_if(vRestarts.begin(),
+                                      vRestarts.end(),
+                                      [pClass](const pair<ClassComment*, size_t> &p)
+                                      {
+                                          return p.first == pClass;
+                                      });
+        if (itRestart == vRestarts.end())
+            vRestarts.emplace_back(pClass, ofsRestart);
+        else if (ofsMatch < itRestart->second)
+            continue;
+        else
+            itRestart->second = ofsRestart;
+
+        if (strNew.empty())
+            strNew.reserve(len + len / 4);
+        strNew.append(str, ofsCopied, ofsName - ofsCopied);
+        if (!fHTML)
+            strNew += pClass->_strOtherLaTeX;
+        else if (pstrSelf && (strWord == *pstrSelf))
+            strNew += pClass->_strSelfHTML;
+        else
+            strNew += pClass->_strOtherHTML;
+        ofsCopied = i;
+    }
+
+    if (ofsCopied)
+    {
+        strNew.append(str, ofsCopied, string::npos);
+        str.swap(strNew);
+    }
+
+    for (const auto &it : g_mapOtherClassNames)
     {
         const string &strClass = it.first;
         PClassComment pClass = it.second;
@@ -221,21 +367,50 @@ void ClassComment::LinkifyClasses(FormatterBase &fmt,
 }
 
 /**
- *  Called from CommentBase::formatComment() for each class to linkify class names.
+ *  Called from LinkifyClasses() for each class whose name is not a plain identifier.
  */
 void ClassComment::linkify(FormatterBase &fmt,
                            string &str,
                            bool fSelf)
 {
     if (fmt.getMode() == OutputMode::HTML)
-        _reClassHTML.findReplace(str,
-                             fSelf ? _strReplSelfHTML
-                                   : _strReplOtherHTML,
-                             true); // fGlobal
+        _pReClassHTML->findReplace(str,
+                                   "$1" + (fSelf ? _strSelfHTML
+                                                 : _strOtherHTML) + "$2",
+                                   true); // fGlobal
     else
-        _reClassLaTeX.findReplace(str,
-                                  _strReplOtherLaTeX,
-                                  true); // fGlobal
+        _pReClassLaTeX->findReplace(str,
+                                    "$1" + _strOtherLaTeX + "$2",
+                                    true); // fGlobal
+}
+
+/**
+ *  Builds the class hierarchy: finds the documented parents of every class and adds the
+ *  class to their children. Must be called once after all files have been parsed.
+ */
+/* static */
+void ClassComment::ResolveParents()
+{
+    for (auto it : g_mapClasses)
+    {
+        const string &strClass = it.first;
+        auto pClass = it.second;
+
+        for (const auto &strParent : pClass->_vParents)
+        {
+            auto pParent = Find(strParent);
+            if (pParent)
+            {
+                pClass->_vParentClasses.push_back(pParent.get());
+                pParent->addChild(pClass);
+            }
+            else
+            {
+                Debug::Warning("Ignoring unknown parent class \"" + strParent + "\" of class \"" + strClass + "\"");
+                pClass->_fUnknownParents = true;
+            }
+        }
+    }
 }
 
 /* static */
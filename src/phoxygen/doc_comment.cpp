@@ -14,12 +14,108 @@
 
 #include <sstream>
 
+/***************************************************************************
+ *
+ *  CommentText
+ *
+ **************************************************************************/
+
+/**
+ *  Appends the lines of the given text. Those are copied if they are kept alive by a
+ *  different file or copy buffer than ours.
+ */
+void CommentText::append(const CommentText &text)
+{
+    if (_vLines.empty())
+        *this = text;
+    else if (    (_pFile == text._pFile)
+              && (_pCopies == text._pCopies)
+            )
+        _vLines.insert(_vLines.end(), text._vLines.begin(), text._vLines.end());
+    else
+        // The other lines are kept alive by something else.
+        for (const auto &svLine : text._vLines)
+            addCopy(svLine);
+}
+
+/**
+ *  Returns the comment text with the prefixes stripped from the lines, each line
+ *  followed by a newline.
+ */
+string CommentText::toString() const
+{
+    size_t cb = 0;
+    for (const auto &svLine : _vLines)
+        cb += svLine.length() + 1;
+
+    string str;
+    str.reserve(cb);
+    for (const auto &svLine : _vLines)
+    {
+        string_view sv = StripPrefix(svLine);
+        str.append(sv.data(), sv.length());
+        str += '\n';
+    }
+
+    return str;
+}
+
+/**
+ *  Returns the given doc comment line without its leading " * ". This is s/^\s+\* ?//
+ *  without copying the line.
+ */
+/* static */
+string_view CommentText::StripPrefix(string_view svLine)
+{
+    size_t p = 0;
+    while ((p < svLine.length()) && (isspace((unsigned char)svLine[p])))
+        ++p;
+    if (    (p > 0)
+         && (p < svLine.length())
+         && (svLine[p] == '*')
+       )
+    {
+        ++p;
+        if ((p < svLine.length()) && (svLine[p] == ' '))
+            ++p;
+        return svLine.substr(p);
+    }
+
+    return svLine;
+}
+
+
+/***************************************************************************
+ *
+ *  CommentBase
+ *
+ **************************************************************************/
+
 const string CommentBase::s_strUnknown = "Unknown";
 
+/**
+ *  Returns the regex for \refs, after formatComment() and resolveRefs() have replaced
+ *  them with @ref.
+ */
+static const Regex& GetRefRegex()
+{
+    static const Regex s_reResolveRefs(R"i____(@ref\s+([-a-zA-Z0-9:\(\\_]+))i____");
+    return s_reResolveRefs;
+}
+
+/**
+ *  Returns the regex for REST API references like "GET /ticket REST".
+ */
+static const Regex& GetRESTRefRegex()
+{
+    static const Regex s_reRESTAPI(R"i____((GET|POST|PUT|DELETE)\s+\/([-a-zA-Z]+)\s+REST)i____");
+    return s_reRESTAPI;
+}
+
 CommentBase::CommentBase(Type theType,
                          const string &strKeyword,
                          const string &strIdentifier,
-                         const string &strComment,
+                         const CommentText &comment,
                          const string &strFile,
                          int linenoFirst,
                          int linenoLast,
@@ -27,7 +123,7 @@ CommentBase::CommentBase(Type theType,
     : _type(theType),
         _keyword(strKeyword),
         _identifier(strIdentifier),
-        _comment(strComment),
+        _comment(comment),
         _file(strFile),
         _linenoFirst(linenoFirst),
         _linenoLast(linenoLast)
@@ -67,7 +163,7 @@ string CommentBase::formatComment(OutputMode mode)
 
     // Replace all \ref with @ref. This allows for using both syntaxes and also avoids problems with
     // escaping \\ in LaTeX.
-    string strComment2 = _comment;
+    string strComment2 = _comment.toString();
     stringReplace(strComment2, "\\ref", "@ref");
 
     stringstream ss(strComment2);
@@ -200,76 +296,145 @@ string CommentBase::formatComment(OutputMode mode)
     // htmlComment =~ s/\\ref\s+([a-zA-Z_0-9]+::[a-zA-Z_0-9]+\(\))/resolveFunctionRef($1)/eg;
 
     // Resolve \refs to page IDs.
-    static const Regex s_reResolveRefs(R"i____(@ref\s+([-a-zA-Z0-9:\(\\_]+))i____");
-    s_reResolveRefs.findReplace(strOutput,
-                                [&fmt, this](const StringVector &vMatches, string &strReplace)
-                                {
-                                    strReplace = this->resolveExplicitRef(fmt, vMatches[1]);
-                                },
-                                true);
+    GetRefRegex().findReplace(strOutput,
+                              [&fmt, this](const RegexMatches &aMatches, string &strReplace)
+                              {
+                                  strReplace = this->resolveExplicitRef(fmt, string(aMatches.view(1)));
+                              },
+                              true);
 
     // Linkify REST API references.
-    static const Regex s_reRESTAPI(R"i____((GET|POST|PUT|DELETE)\s+\/([-a-zA-Z]+)\s+REST)i____");
-    s_reRESTAPI.findReplace(strOutput,
-                            [&fmt](const StringVector &vMatches, string &strReplace)
-                            {
-                                const string &strMethod = vMatches[1];
-                                const string &strName = vMatches[2];
-                                string strIdentifier = RESTComment::MakeIdentifier(strMethod, strName);
-                                PRESTComment pREST;
-                                if ((pREST = RESTComment::Find(strIdentifier)))
-                                    strReplace = pREST->makeLink(fmt);
-                                else
-                                {
-                                    Debug::Warning("Invalid REST API reference " + strIdentifier);
-                                    strReplace = "?!?!? " + strIdentifier;
-                                }
-                            },
-                            true);
+    GetRESTRefRegex().findReplace(strOutput,
+                                  [&fmt, this](const RegexMatches &aMatches, string &strReplace)
+                                  {
+                                      strReplace = this->resolveRESTRef(fmt,
+                                                                        RESTComment::MakeIdentifier(string(aMatches.view(1)),
+                                                                                                    string(aMatches.view(2))));
+                                  },
+                                  true);
 
     return strOutput;
 }
 
 /**
- *  Called from a closure in formatComment() whenever a \ref is encountered. strMatch has the
- *  contents of what follows \ref, see the regexp in the code above.
+ *  Binds the \refs and REST API references in the comment text to what they refer to,
+ *  and warns about those that refer to nothing, so that formatComment() only has to look
+ *  them up. Called for every comment that gets written, after all files have been parsed.
  */
-string CommentBase::resolveExplicitRef(FormatterBase &fmt,
-                                       const string &strMatch0)
+void CommentBase::resolveRefs()
 {
-    // In LaTeX mode, the ref has underscores escaped; then we need to unescape them.
-    string strMatch = strMatch0;
-    if (fmt.getMode() == OutputMode::LATEX)
-        stringReplace(strMatch, "\\_", "_");
+    string strComment = _comment.toString();
+    stringReplace(strComment, "\\ref", "@ref");
+
+    RegexMatches aMatches;
+    size_t ofs = 0;
+    while (GetRefRegex().matches(strComment, aMatches, ofs))
+    {
+        string strMatch(aMatches.view(1));
+        if (!_mapExplicitRefs.count(strMatch))
+            _mapExplicitRefs.emplace(strMatch, bindExplicitRef(strMatch));
+    }
+
+    ofs = 0;
+    while (GetRESTRefRegex().matches(strComment, aMatches, ofs))
+    {
+        string strIdentifier = RESTComment::MakeIdentifier(string(aMatches.view(1)),
+                                                           string(aMatches.view(2)));
+        if (!_mapRESTRefs.count(strIdentifier))
+        {
+            PRESTComment pREST = RESTComment::Find(strIdentifier);
+            if (!pREST)
+                Debug::Warning("Invalid REST API reference " + strIdentifier);
+            _mapRESTRefs[strIdentifier] = pREST.get();
+        }
+    }
+}
 
-    PTableComment pTable;
-    PPageComment pPage;
+/**
+ *  Finds what the given \ref refers to: a table, a page, or a function, with or without
+ *  its class. Warns if there is no such thing.
+ */
+CommentBase::ExplicitRef CommentBase::bindExplicitRef(const string &strMatch)
+{
+    ExplicitRef ref;
     RegexMatches aMatches2;
-    if ((pTable = TableComment::Find(strMatch)))
-        return pTable->makeLink(fmt);
+    if ((ref.pTable = TableComment::Find(strMatch).get()))
+        return ref;
 
-    if ((pPage = PageComment::Find(strMatch)))
-        return pPage->makeLink(fmt);
+    if ((ref.pPage = PageComment::Find(strMatch).get()))
+        return ref;
 
     static const Regex s_reClassAndFunction(R"i____((?:([a-zA-Z_0-9]+)::)?([a-zA-Z_0-9]+)\()i____");
     if (s_reClassAndFunction.matches(strMatch, aMatches2))
     {
-        PClassComment p2;
         const string &strClass = aMatches2.get(1);
-        const string &strFunction = aMatches2.get(2);
-        ClassComment *pClass;
         if (strClass.empty())
-            pClass = this->getClassForFunctionRef();
-        else
+            ref.pClass = this->getClassForFunctionRef();
+        else if (!(ref.pClass = ClassComment::Find(strClass).get()))
+            Debug::Warning("Invalid class \"" + strClass + "\" in \\ref to function \"" + strMatch + "\"");
+        if (ref.pClass)
         {
-            if (!(p2 = ClassComment::Find(strClass)))
-                Debug::Warning("Invalid class \"" + strClass + "\" in \\ref to function \"" + strMatch + "\"");
-            pClass = p2.get();
+            ref.strFunction = aMatches2.get(2);
+            return ref;
         }
-        if (pClass)
-            return pClass->makeLink(fmt, strMatch, &strFunction);
     }
 
     Debug::Warning("Invalid \\ref " + strMatch);
-    return "?!?!?!?";
+    return ref;
+}
+
+/**
+ *  Called from a closure in formatComment() whenever a \ref is encountered. strMatch has the
+ *  contents of what follows \ref, see the regexp in the code above.
+ *
+ *  This only looks up what resolveRefs() has bound and does not warn; resolveRefs() has
+ *  already done that for the invalid ones.
+ */
+string CommentBase::resolveExplicitRef(FormatterBase &fmt,
+                                       const string &strMatch0) const
+{
+    // In LaTeX mode, the ref has underscores escaped; then we need to unescape them. A
+    // special character right after the ref is escaped too, and the regex picks up the
+    // backslash of that, which must be put back after the link.
+    string strMatch = strMatch0;
+    string strAfter;
+    if (fmt.getMode() == OutputMode::LATEX)
+    {
+        stringReplace(strMatch, "\\_", "_");
+        if (endsWith(strMatch, "\\"))
+        {
+            strMatch.pop_back();
+            strAfter = "\\";
+        }
+    }
+
+    auto it = _mapExplicitRefs.find(strMatch);
+    if (it != _mapExplicitRefs.end())
+    {
+        const ExplicitRef &ref = it->second;
+        if (ref.pTable)
+            return ref.pTable->makeLink(fmt) + strAfter;
+        if (ref.pPage)
+            return ref.pPage->makeLink(fmt) + strAfter;
+        if (ref.pClass)
+            return ref.pClass->makeLink(fmt, strMatch, &ref.strFunction) + strAfter;
+    }
+
+    return "?!?!?!?" + strAfter;
+}
+
+/**
+ *  Called from a closure in formatComment() for every REST API reference, like
+ *  resolveExplicitRef().
+ */
+string CommentBase::resolveRESTRef(FormatterBase &fmt,
+                                   const string &strIdentifier) const
+{
+    auto it = _mapRESTRefs.find(strIdentifier);
+    if (    (it != _mapRESTRefs.end())
+         && (it->second)
+       )
+        return it->second->makeLink(fmt);
+
+    return "?!?!? " + strIdentifier;
 }
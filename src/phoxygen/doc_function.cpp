@@ -9,125 +9,415 @@
  */
 
 #include "phoxygen/phoxygen.h"
+#include "phoxygen/scanner.h"
 
 #include "xwp/debug.h"
 #include "xwp/regex.h"
 #include "xwp/except.h"
 
+#include <string.h>
+#include <unordered_map>
+
+FunctionsVector g_vFunctions;
+
+/**
+ *  A parameter type formatted by linkifyParams().
+ */
+struct FormattedType
+{
+    string  strHTML;
+    string  strLaTeX;
+};
+
+// Formatted parameter types by type, see linkifyParams().
+unordered_map<string, FormattedType> g_mapFormattedTypes;
+
 void FunctionComment::setClass(PClassComment pClass)
 {
     _pClass = pClass;
 }
 
-void FunctionComment::parseParam(string &oneParam,
-                                 const string &descr)
+/**
+ *  Parses one parameter from a function header, e.g. "?User &$user = NULL", and adds it
+ *  to the list. The description is filled in later by parseArguments().
+ */
+void FunctionComment::addParam(string_view svParam)
 {
-    RegexMatches aMatches2;
-    // First check if there is a default argument.
-    static const Regex s_reDefaultArg(R"i____((.+)(=.*))i____");
-    string strDefaultArg;
-    if (s_reDefaultArg.matches(oneParam, aMatches2))
+    // Skip PHP 8 attributes and constructor promotion modifiers.
+    size_t ofs = 0;
+    while (1)
     {
-        oneParam = aMatches2.get(1);
-        strDefaultArg = trimmed(aMatches2.get(2));
+        while ((ofs < svParam.length()) && (isspace((unsigned char)svParam[ofs])))
+            ++ofs;
+        if (svParam.substr(ofs, 2) == "#[")
+        {
+            size_t ofsEnd = svParam.find(']', ofs);
+            if (ofsEnd == string_view::npos)
+                break;
+            ofs = ofsEnd + 1;
+            continue;
+        }
+
+        bool fModifier = false;
+        for (const char *pcsz : { "public", "protected", "private", "readonly" })
+        {
+            size_t cb = strlen(pcsz);
+            if (    (svParam.substr(ofs, cb) == pcsz)
+                 && (ofs + cb < svParam.length())
+                 && (isspace((unsigned char)svParam[ofs + cb]))
+               )
+            {
+                ofs += cb;
+                fModifier = true;
+                break;
+            }
+        }
+        if (!fModifier)
+            break;
+    }
+    svParam.remove_prefix(ofs);
+
+    if (svParam.empty())
+        return;     // f() or a trailing comma.
+
+    // The default value starts at the first '=' that is not in brackets or quotes.
+    string_view svDefaultArg;
+    size_t ofsEquals = string_view::npos;
+    uint uDepth = 0;
+    char cQuote = 0;
+    for (size_t i = 0;
+         i < svParam.length();
+         ++i)
+    {
+        char c = svParam[i];
+        if (cQuote)
+        {
+            if (c == '\\')
+                ++i;
+            else if (c == cQuote)
+                cQuote = 0;
+        }
+        else if ((c == '\'') || (c == '"'))
+            cQuote = c;
+        else if ((c == '(') || (c == '['))
+            ++uDepth;
+        else if (((c == ')') || (c == ']')) && uDepth)
+            --uDepth;
+        else if ((c == '=') && (!uDepth))
+        {
+            ofsEquals = i;
+            break;
+        }
+    }
+    if (ofsEquals != string_view::npos)
+    {
+        svDefaultArg = svParam.substr(ofsEquals + 1);
+        svParam = svParam.substr(0, ofsEquals);
+    }
+
+    // The name is the last variable, including a leading "&" and "...". Everything before
+    // it is the type, including the white space up to the name.
+    size_t ofsName = svParam.rfind('$');
+    if (ofsName == string_view::npos)
+        throw FSException("cannot figure out type from param \"" + trimmed(svParam) + "\" in function \"" + _identifier + "\"");
+    size_t ofsNameEnd = ofsName + 1;
+    while ((ofsNameEnd < svParam.length()) && (isIdentifierChar(svParam[ofsNameEnd])))
+        ++ofsNameEnd;
+    if ((ofsName >= 3) && (svParam.substr(ofsName - 3, 3) == "..."))
+        ofsName -= 3;
+    if ((ofsName > 0) && (svParam[ofsName - 1] == '&'))
+        --ofsName;
+
+    _vParams.emplace_back(string(svParam.substr(0, ofsName)),
+                          string(svParam.substr(ofsName, ofsNameEnd - ofsName)),
+                          trimmed(svDefaultArg),
+                          "",
+                          "",
+                          "");
+}
+
+/**
+ *  Adds the given function to the global list, which LinkifyAllParams() works on.
+ */
+/* static */
+void FunctionComment::Add(PFunctionComment p)
+{
+    g_vFunctions.push_back(p);
+}
+
+/**
+ *  Formats a parameter type for HTML and LaTeX, with links to the classes in it.
+ *
+ *  Each name in the type is linkified on its own, so that nullable and union types
+ *  like "?User" or "User|Group" get links as well. Of a namespace-qualified name like
+ *  "\App\Models\User", only the class name at the end is linkified, not the namespace
+ *  segments, which could otherwise match unrelated classes of the same short name.
+ */
+static void FormatType(const string &strType,
+                       const string *pstrSelf,
+                       FormattedType &type)
+{
+    FormatterBase &fmtHTML = FormatterBase::Get(OutputMode::HTML);
+    FormatterBase &fmtLaTeX = FormatterBase::Get(OutputMode::LATEX);
+
+    auto isNameChar = [](char c)
+    {
+        return isIdentifierChar(c) || (c == '\\');
+    };
+
+    size_t i = 0;
+    while (i < strType.length())
+    {
+        size_t ofsStart = i;
+        bool fName = isNameChar(strType[i]);
+        while ((i < strType.length()) && (isNameChar(strType[i]) == fName))
+            ++i;
+
+        string strPart = strType.substr(ofsStart, i - ofsStart);
+        if (fName)
+        {
+            // Pass the namespace through as it is.
+            size_t ofsBackslash = strPart.rfind('\\');
+            if (ofsBackslash != string::npos)
+            {
+                string strNamespace = strPart.substr(0, ofsBackslash + 1);
+                type.strHTML += strNamespace;
+                type.strLaTeX += strNamespace;
+                strPart.erase(0, ofsBackslash + 1);
+            }
+        }
+
+        if (    (!fName)
+             || (strPart.empty())
+           )
+        {
+            type.strHTML += strPart;
+            type.strLaTeX += strPart;
+        }
+        else
+        {
+            string strHTML(strPart);
+            ClassComment::LinkifyClasses(fmtHTML,
+                                         strHTML,
+                                         pstrSelf);
+            type.strHTML += strHTML;
+
+            ClassComment::LinkifyClasses(fmtLaTeX,
+                                         strPart,
+                                         pstrSelf);
+            type.strLaTeX += strPart;
+        }
     }
+}
 
-    static const Regex s_reType(R"i____(\s*([A-Za-z0-9_]+\s+)?(&?\$[A-Za-z0-9_]+)\s*)i____");
-    if (!s_reType.matches(oneParam, aMatches2))
-        throw FSException("cannot figure out type from param \"" + oneParam + "\" in function \"" + _identifier + "\"");
+/**
+ *  Returns true if strName is one of the names in the parameter type.
+ */
+static bool TypeHasName(const string &strType,
+                        const string &strName)
+{
+    for (size_t ofs = strType.find(strName);
+         ofs != string::npos;
+         ofs = strType.find(strName, ofs + 1))
+    {
+        size_t ofsEnd = ofs + strName.length();
+        if (    ((ofs == 0) || (!isIdentifierChar(strType[ofs - 1])))
+             && ((ofsEnd == strType.length()) || (!isIdentifierChar(strType[ofsEnd])))
+           )
+            return true;
+    }
+    return false;
+}
 
-    string type;
-    string strTypeFormattedHTML, strTypeFormattedLaTeX;
-    bool fType = aMatches2.size();
-    if (fType)
+/**
+ *  Linkifies the parameter types against all classes. Called from LinkifyAllParams().
+ *
+ *  The same few types (int, string, array, the common classes) occur over and over, so
+ *  the formatted types are cached by type. The cache is bypassed for types that contain
+ *  the function's own name, which LinkifyClasses() makes bold instead of a link.
+ */
+void FunctionComment::linkifyParams()
+{
+    for (auto &param : _vParams)
     {
-        type = aMatches2.get(1);
+        const string &strType = param._type;
+        if (TypeHasName(strType, _identifier))
+        {
+            FormattedType type;
+            FormatType(strType, &_identifier, type);
+            param._strTypeFormattedHTML = type.strHTML;
+            param._strTypeFormattedLaTeX = type.strLaTeX;
+            continue;
+        }
 
-        if (type.length())
+        auto it = g_mapFormattedTypes.find(strType);
+        if (it == g_mapFormattedTypes.end())
         {
-            auto fmt1 = FormatterBase::Get(OutputMode::HTML);
-            strTypeFormattedHTML = type;
-            ClassComment::LinkifyClasses(fmt1,
-                                        strTypeFormattedHTML,
-                                        &_identifier);
-
-            auto fmt2 = FormatterBase::Get(OutputMode::LATEX);
-            strTypeFormattedLaTeX = type;
-            ClassComment::LinkifyClasses(fmt2,
-                                        strTypeFormattedLaTeX,
-                                        &_identifier);
+            FormattedType type;
+            FormatType(strType, NULL, type);
+            it = g_mapFormattedTypes.emplace(strType, std::move(type)).first;
         }
+        param._strTypeFormattedHTML = it->second.strHTML;
+        param._strTypeFormattedLaTeX = it->second.strLaTeX;
     }
-    const string &argname = aMatches2.get( (fType) ? 2 : 1);
-
-    _vParams.push_back(Param(type,
-                             argname,
-                             strDefaultArg,
-                             descr,
-                             strTypeFormattedHTML,
-                             strTypeFormattedLaTeX));
+}
+
+/**
+ *  Linkifies the parameter types of all functions. Must be called once after all files
+ *  have been parsed, so that types can refer to classes from any file.
+ */
+/* static */
+void FunctionComment::LinkifyAllParams()
+{
+    for (auto &pFunction : g_vFunctions)
+        pFunction->linkifyParams();
 }
 
 
 /**
- *  Called from main.cpp for every line after a function comment that has
- *  arguments, until the closing bracket.
+ *  Called from main.cpp for the rest of the line after the opening bracket of a
+ *  function header, and then for every following line until the closing bracket.
+ *
+ *  This scans the parameter list a character at a time, keeping track of nested
+ *  brackets and quotes, so default values like array(1, 2) or ['a', 'b'] and
+ *  parameters that span several lines work. Every parameter goes straight into
+ *  the parameter list; a "//!<" comment on a line becomes the description of the
+ *  parameters that end on that line.
  *
- *  For every line, if the line was recognized as a function comment,
- *  this function must set state to State::IN_FUNCTION_HEADER; if the
- *  closing bracket was encountered, state must be set back to State::INIT.
+ *  As long as the closing bracket has not been found, this sets state to
+ *  State::IN_FUNCTION_HEADER; afterwards, or if the header does not make sense,
+ *  it is set back to State::INIT.
  */
-void FunctionComment::parseArguments(const string &strLine,
+void FunctionComment::parseArguments(string_view strLine,
                                      State &state)
 {
-    /*
-     *   1.  When called for first time, strLine has everything after "(". This
-     *       could be
-     *
-     *          --  "Type $var[,)]"
-     *
-     *          --  "$var1 = "default", $var2[,)]"
-     *
-     *          --  "$var1, Type $var2[,)]"
-     *
-     *          --  "$var1[,)] //!< comment"
-     *
-     *   2.  When called fur subsequent lines, the input should be exactly the same.
-     *
-     */
-
-    RegexMatches aMatches;
-    static const Regex s_reFuncOpen(R"i____(^\s*([&\$A-Za-z0-9_ ='":!-]+)\s*([,;)]+)\s*(?:\/\/!<\s*(.*))?$)i____");
-    static const Regex s_reFuncEnd(R"i____((.*)\)(.*))i____");
-    if (s_reFuncOpen.matches(strLine, aMatches))
+    size_t iFirstParamOnLine = _vParams.size();
+    size_t ofsParam = 0;            // Start of the current parameter on this line.
+    string_view svDescription;
+    bool fDone = false;
+    bool fError = false;
+
+    size_t i = 0;
+    for (;
+         i < strLine.length();
+         ++i)
     {
-        const string &params = aMatches.get(1);
-        const string &sep = aMatches.get(2);
-        const string &descr = (aMatches.size() > 2) ? aMatches.get(3) : "";
-
-        // See if param is really several params.
-        StringVector vParams = explodeVector(params, ",");
-        for (auto oneParam : vParams)
-            parseParam(oneParam, descr);
-
-        state = (sep == ",")
-            ? State::IN_FUNCTION_HEADER
-            : State::INIT;
+        char c = strLine[i];
+        if (_cQuote)
+        {
+            if (c == '\\')
+                ++i;
+            else if (c == _cQuote)
+                _cQuote = 0;
+            continue;
+        }
+
+        if (    ((c == '/') && (strLine.substr(i, 2) == "//"))
+             || ((c == '#') && (strLine.substr(i, 2) != "#["))
+           )
+        {
+            // Line comment; it is a description only if it is "//!<".
+            if (strLine.substr(i, 4) == "//!<")
+            {
+                svDescription = strLine.substr(i + 4);
+                while ((!svDescription.empty()) && (isspace((unsigned char)svDescription[0])))
+                    svDescription.remove_prefix(1);
+            }
+            break;
+        }
+
+        if (fDone)
+        {
+            // Only look for a description after the closing bracket.
+            if ((c == '\'') || (c == '"'))
+                _cQuote = c;
+            continue;
+        }
+
+        switch (c)
+        {
+            case '\'':
+            case '"':
+                _cQuote = c;
+            break;
+
+            case '(':
+            case '[':
+                ++_uDepth;
+            break;
+
+            case ']':
+                if (_uDepth)
+                    --_uDepth;
+            break;
+
+            case ',':
+            case ')':
+                if (_uDepth)
+                {
+                    if (c == ')')
+                        --_uDepth;
+                    break;
+                }
+
+                // End of a parameter.
+                if (_strPendingParam.empty())
+                    addParam(strLine.substr(ofsParam, i - ofsParam));
+                else
+                {
+                    _strPendingParam.append(strLine.substr(ofsParam, i - ofsParam));
+                    addParam(_strPendingParam);
+                    _strPendingParam.clear();
+                }
+                ofsParam = i + 1;
+
+                if (c == ')')
+                    fDone = true;
+            break;
+
+            case '{':
+            case '}':
+            case ';':
+                // These cannot appear in a parameter list outside of quotes.
+                if (!_uDepth)
+                    fError = true;
+            break;
+        }
+
+        if (fError)
+            break;
     }
-    else if (s_reFuncEnd.matches(strLine, aMatches))
-    {
-        const string &args = aMatches.get(1);
-        const string &descr = aMatches.get(2);
-        StringVector vParams = explodeVector(args, ",");
-        for (auto oneParam : vParams)
-            parseParam(oneParam, descr);
 
+    if (fError)
+    {
+        Debug::Warning("don't know how to handle function header in " + formatContext());
+        _strPendingParam.clear();
+        _uDepth = 0;
+        _cQuote = 0;
         state = State::INIT;
+        return;
     }
-    else
+
+    if (!fDone)
     {
-        Debug::Warning("don't know how to handle function header in " + formatContext());
+        // The parameter continues on the next line.
+        string_view svRest = strLine.substr(ofsParam, std::min(i, strLine.length()) - ofsParam);
+        if (    (!_strPendingParam.empty())
+             || (svRest.find_first_not_of(" \t\r") != string_view::npos)
+           )
+        {
+            _strPendingParam.append(svRest);
+            _strPendingParam += ' ';
+        }
     }
+
+    if (!svDescription.empty())
+        for (size_t u = iFirstParamOnLine;
+             u < _vParams.size();
+             ++u)
+            _vParams[u]._description = string(svDescription);
+
+    state = (fDone) ? State::INIT : State::IN_FUNCTION_HEADER;
 }
 
 string FunctionComment::formatFunction(FormatterBase &fmt,
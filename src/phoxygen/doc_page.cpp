@@ -20,7 +20,7 @@ PageComment::PageComment(const string &strPageID,
         : CommentBase(Type::PAGE,
                       "",
                       strPageID,
-                      "",
+                      CommentText(),
                       strInputFile,
                       linenoFirst,
                       linenoLast,
@@ -41,9 +41,13 @@ PPageComment PageComment::Make(const string &strPageID,
                                int linenoFirst,
                                int linenoLast) : PageComment(strPageID, strTitle, strInputFile, linenoFirst, linenoLast) {}
     };
-    auto p = make_shared<Derived>(strPageID, strTitle, strInputFile, linenoFirst, linenoLast);
-    g_mapPages[strPageID] = p;
-    return p;
+    return make_shared<Derived>(strPageID, strTitle, strInputFile, linenoFirst, linenoLast);
+}
+
+/* static */
+void PageComment::Add(PPageComment p)
+{
+    g_mapPages[p->getIdentifier()] = p;
 }
 
 /* virtual */
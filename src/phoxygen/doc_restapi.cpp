@@ -15,14 +15,14 @@ RESTMap g_mapRESTComments;
 RESTComment::RESTComment(const string &strMethod,
                          const string &strName,
                          const string &strArgs,
-                         const string &strComment,
+                         const CommentText &comment,
                          const string &strInputFile,
                          int linenoFirst,
                          int linenoLast)
     : CommentBase(Type::REST,
                   "",
                   "",       // identifier, see below
-                  strComment,
+                  comment,
                   strInputFile,
                   linenoFirst,
                   linenoLast,
@@ -40,7 +40,7 @@ RESTComment::RESTComment(const string &strMethod,
 PRESTComment RESTComment::Make(const string &strMethod,
                                const string &strName,
                                const string &strArgs,
-                               const string &strComment,
+                               const CommentText &comment,
                                const string &strInputFile,
                                int linenoFirst,
                                int linenoLast)
@@ -48,20 +48,24 @@ PRESTComment RESTComment::Make(const string &strMethod,
     class Derived : public RESTComment { public: Derived(const string &strMethod,
                                const string &strName,
                                const string &strArgs,
-                               const string &strComment,
+                               const CommentText &comment,
                                const string &strInputFile,
                                int linenoFirst,
-                               int linenoLast) : RESTComment(strMethod, strName, strArgs, strComment, strInputFile, linenoFirst, linenoLast) {}
+                               int linenoLast) : RESTComment(strMethod, strName, strArgs, comment, strInputFile, linenoFirst, linenoLast) {}
     };
-    auto p = make_shared<Derived>(strMethod,
-                                  strName,
-                                  strArgs,
-                                  strComment,
-                                  strInputFile,
-                                  linenoFirst,
-                                  linenoLast);
+    return make_shared<Derived>(strMethod,
+                                strName,
+                                strArgs,
+                                comment,
+                                strInputFile,
+                                linenoFirst,
+                                linenoLast);
+}
+
+/* static */
+void RESTComment::Add(PRESTComment p)
+{
     g_mapRESTComments[p->getIdentifier()] = p;
-    return p;
 }
 
 /* virtual */
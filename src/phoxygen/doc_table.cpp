@@ -9,33 +9,197 @@
  */
 
 #include "phoxygen/phoxygen.h"
+#include "phoxygen/scanner.h"
 
 #include "xwp/debug.h"
 #include "xwp/regex.h"
 #include "xwp/except.h"
 
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+
 TablesMap g_mapTables;
 
+/**
+ *  A token in the body of a CREATE TABLE statement: a word (keyword, identifier, number,
+ *  quoted identifier or string, or a single other character), or a group in brackets
+ *  with everything in it.
+ */
+struct SQLToken
+{
+    string_view     sv;
+    size_t          ofs;            // Offset in the body.
+    bool            fGroup;
+};
+typedef vector<SQLToken> SQLTokensVector;
+
+static bool isKeyword(const SQLToken &t,
+                      const char *pcszKeyword)
+{
+    return    (!t.fGroup)
+           && (t.sv.length() == strlen(pcszKeyword))
+           && (!strncasecmp(t.sv.data(), pcszKeyword, t.sv.length()));
+}
+
+static bool isAnyKeyword(const SQLToken &t,
+                         const vector<const char*> &vKeywords)
+{
+    for (const char *pcsz : vKeywords)
+        if (isKeyword(t, pcsz))
+            return true;
+
+    return false;
+}
+
+/**
+ *  Returns the offset after the quoted string that starts at ofs.
+ */
+static size_t skipQuoted(string_view sv,
+                         size_t ofs)
+{
+    char cQuote = sv[ofs];
+    for (size_t i = ofs + 1;
+         i < sv.length();
+         ++i)
+    {
+        if (sv[i] == '\\')
+            ++i;
+        else if (sv[i] == cQuote)
+            return i + 1;
+    }
+
+    return sv.length();
+}
+
+/**
+ *  Returns sv without the quotes if it is a quoted identifier.
+ */
+static string_view unquoted(string_view sv)
+{
+    if (    (sv.length() >= 2)
+         && ((sv[0] == '"') || (sv[0] == '`'))
+         && (sv.back() == sv[0])
+       )
+        return sv.substr(1, sv.length() - 2);
+
+    return sv;
+}
+
+/**
+ *  Returns sv with white space trimmed at both ends and collapsed to single spaces
+ *  in between.
+ */
+static string simplified(string_view sv)
+{
+    string str;
+    bool fSpace = false;
+    for (char c : sv)
+    {
+        if (isspace((unsigned char)c))
+            fSpace = true;
+        else
+        {
+            if ((fSpace) && (!str.empty()))
+                str += ' ';
+            str += c;
+            fSpace = false;
+        }
+    }
+
+    return str;
+}
+
+/**
+ *  Returns the text inside the brackets of a group token.
+ */
+static string groupContents(const SQLToken &t)
+{
+    return simplified(t.sv.substr(1, t.sv.length() - 2));
+}
+
+/**
+ *  Splits one column definition or table constraint, given as offsets into the body, into tokens.
+ */
+static void tokenize(string_view svBody,
+                     size_t ofsBegin,
+                     size_t ofsEnd,
+                     SQLTokensVector &vTokens)
+{
+    size_t i = ofsBegin;
+    while (i < ofsEnd)
+    {
+        char c = svBody[i];
+        size_t ofsToken = i;
+        bool fGroup = false;
+
+        if (isspace((unsigned char)c))
+        {
+            ++i;
+            continue;
+        }
+
+        if (svBody.substr(i, 2) == "--")
+        {
+            i = std::min(svBody.find('\n', i), ofsEnd);
+            continue;
+        }
+
+        if (c == '(')
+        {
+            uint depth = 0;
+            while (i < ofsEnd)
+            {
+                c = svBody[i];
+                if ((c == '\'') || (c == '"') || (c == '`'))
+                {
+                    i = skipQuoted(svBody, i);
+                    continue;
+                }
+                ++i;
+                if (c == '(')
+                    ++depth;
+                else if ((c == ')') && (!--depth))
+                    break;
+            }
+            fGroup = true;
+        }
+        else if ((c == '\'') || (c == '"') || (c == '`'))
+            i = skipQuoted(svBody, i);
+        else if (isIdentifierChar(c))
+            while ((i < ofsEnd) && (isIdentifierChar(svBody[i])))
+                ++i;
+        else
+            ++i;
+
+        i = std::min(i, ofsEnd);
+        vTokens.push_back({ svBody.substr(ofsToken, i - ofsToken), ofsToken, fGroup });
+    }
+}
+
 /* static */
 PTableComment TableComment::Make(const string &strIdentifier,
-                                 const string &strComment,
+                                 const CommentText &comment,
                                  const string &strInputFile,
                                  int linenoFirst,
                                  int linenoLast)
 {
     class Derived : public TableComment { public: Derived(const string &strIdentifier,
-                                 const string &strComment,
+                                 const CommentText &comment,
                                  const string &strInputFile,
                                  int linenoFirst,
-                                 int linenoLast) : TableComment(strIdentifier, strComment, strInputFile, linenoFirst, linenoLast) {}
+                                 int linenoLast) : TableComment(strIdentifier, comment, strInputFile, linenoFirst, linenoLast) {}
     };
-    auto p = make_shared<Derived>(strIdentifier, strComment, strInputFile, linenoFirst, linenoLast);
-    g_mapTables[strIdentifier] = p;
-    return p;
+    return make_shared<Derived>(strIdentifier, comment, strInputFile, linenoFirst, linenoLast);
+}
 
+/* static */
+void TableComment::Add(PTableComment p)
+{
+    g_mapTables[p->getIdentifier()] = p;
 }
 
-void TableComment::processInputLine(const string &strLine,
+void TableComment::processInputLine(string_view strLine,
                                     State &state)
 {
     _vDefinitionLines.push_back(trimmed(strLine));
@@ -46,6 +210,152 @@ void TableComment::processInputLine(const string &strLine,
         state = State::INIT;
 }
 
+/**
+ *  Parses the CREATE TABLE statement that processInputLine() collected into columns,
+ *  table constraints and the REFERENCES clauses in both. Called once when the file
+ *  has been parsed; this uses a simple tokenizer, not a full SQL parser.
+ */
+void TableComment::parseDefinition()
+{
+    static const vector<const char*> s_vTableConstraints( { "CONSTRAINT", "PRIMARY", "FOREIGN", "UNIQUE", "CHECK", "KEY", "INDEX", "EXCLUDE", "FULLTEXT", "SPATIAL" } );
+    static const vector<const char*> s_vColumnConstraints( { "CONSTRAINT", "NOT", "NULL", "PRIMARY", "REFERENCES", "DEFAULT", "UNIQUE", "CHECK", "COLLATE", "AUTO_INCREMENT", "GENERATED", "COMMENT" } );
+
+    _vColumns.clear();
+    _vConstraints.clear();
+    _vReferences.clear();
+
+    string strBody;
+    vector<size_t> vLineStarts;
+    for (const string &strLine : _vDefinitionLines)
+    {
+        vLineStarts.push_back(strBody.length());
+        strBody += strLine + "\n";
+    }
+
+    // Split the part in the outer brackets at the commas that are not in nested brackets.
+    vector<pair<size_t, size_t>> vItems;
+    uint depth = 0;
+    size_t ofsItem = 0;
+    size_t cb = strBody.length();
+    size_t i = 0;
+    while (i < cb)
+    {
+        char c = strBody[i];
+        if ((c == '\'') || (c == '"') || (c == '`'))
+        {
+            i = skipQuoted(strBody, i);
+            continue;
+        }
+
+        if ((c == '-') && (i + 1 < cb) && (strBody[i + 1] == '-'))
+            i = strBody.find('\n', i);
+        else if (c == '(')
+        {
+            if (!depth++)
+                ofsItem = i + 1;
+        }
+        else if ((c == ')') && (depth))
+        {
+            if (!--depth)
+            {
+                vItems.push_back({ ofsItem, i });
+                break;
+            }
+        }
+        else if ((c == ',') && (depth == 1))
+        {
+            vItems.push_back({ ofsItem, i });
+            ofsItem = i + 1;
+        }
+        ++i;
+    }
+
+    for (const auto &item : vItems)
+    {
+        SQLTokensVector vTokens;
+        tokenize(strBody, item.first, item.second, vTokens);
+        size_t cTokens = vTokens.size();
+        if (!cTokens)
+            continue;
+
+        string strColumns;
+        if (isAnyKeyword(vTokens[0], s_vTableConstraints))
+            _vConstraints.push_back(simplified(string_view(strBody).substr(item.first, item.second - item.first)));
+        else
+        {
+            // Column definition: name, then the type up to the first constraint keyword.
+            TableColumn col;
+            col.strName = string(unquoted(vTokens[0].sv));
+            size_t j = 1;
+            while ((j < cTokens) && (!isAnyKeyword(vTokens[j], s_vColumnConstraints)))
+                ++j;
+            if (j > 1)
+                col.strType = simplified(string_view(strBody).substr(vTokens[1].ofs, vTokens[j - 1].ofs + vTokens[j - 1].sv.length() - vTokens[1].ofs));
+            if (j < cTokens)
+                col.strConstraints = simplified(string_view(strBody).substr(vTokens[j].ofs, item.second - vTokens[j].ofs));
+            strColumns = col.strName;
+            _vColumns.push_back(col);
+        }
+
+        for (size_t j = 0;
+             j + 1 < cTokens;
+             ++j)
+        {
+            // FOREIGN KEY (a, b) REFERENCES ...
+            if (    (isKeyword(vTokens[j], "KEY"))
+                 && (vTokens[j + 1].fGroup)
+               )
+                strColumns = groupContents(vTokens[j + 1]);
+
+            if (    (!isKeyword(vTokens[j], "REFERENCES"))
+                 || (vTokens[j + 1].fGroup)
+               )
+                continue;
+
+            const SQLToken &tTable = vTokens[j + 1];
+            string_view svTable = unquoted(tTable.sv);
+            size_t ofs = tTable.ofs + ((svTable.length() < tTable.sv.length()) ? 1 : 0);
+            size_t iLine = std::upper_bound(vLineStarts.begin(), vLineStarts.end(), ofs) - vLineStarts.begin() - 1;
+
+            TableReference ref;
+            ref.strColumns = strColumns;
+            ref.strTable = string(svTable);
+            if ((j + 2 < cTokens) && (vTokens[j + 2].fGroup))
+                ref.strRefColumns = groupContents(vTokens[j + 2]);
+            ref.iLine = iLine;
+            ref.ofs = ofs - vLineStarts[iLine];
+            _vReferences.push_back(ref);
+        }
+    }
+
+    Debug::Log(MAIN, "table " + _identifier + ": " + to_string(_vColumns.size()) + " columns, " + to_string(_vConstraints.size()) + " constraints, " + to_string(_vReferences.size()) + " references");
+}
+
+/**
+ *  Builds the foreign key graph: points every REFERENCES clause of every table to the
+ *  referenced table, if it was documented, and gives each table the list of tables that
+ *  reference it. Must be called once after all files have been parsed.
+ */
+/* static */
+void TableComment::ResolveReferences()
+{
+    for (auto it : g_mapTables)
+    {
+        auto pTable = it.second;
+        for (auto &ref : pTable->_vReferences)
+        {
+            auto pTarget = Find(ref.strTable);
+            if (pTarget)
+            {
+                ref.pTarget = pTarget.get();
+                pTarget->_vReferencedBy.push_back({ pTable.get(), &ref });
+            }
+            else
+                Debug::Log(MAIN, "table " + it.first + " references unknown table " + ref.strTable);
+        }
+    }
+}
+
 /* virtual */
 string TableComment::getTitle(OutputMode mode) /* override */
 {
@@ -78,6 +388,7 @@ string TableComment::formatComment(OutputMode mode) /* override */
         size_t c = 0;
 
         str += fmt.openPRE();
+        auto itRef = _vReferences.begin();
         for (const string &line : _vDefinitionLines)
         {
             ++c;
@@ -85,29 +396,35 @@ string TableComment::formatComment(OutputMode mode) /* override */
             if ( (c > 1) && (c < cLines) )
                 str += "    ";
 
-            string htmlLine = fmt.format(line, true);
-
-//             for (auto it : g_mapTables)
-//             {
-//                 const string &strTable = it.first;
-                Regex reTableRef("REFERENCES\\s+([a-zA-Z_]+)\\(");
-                reTableRef.findReplace( htmlLine,
-                                        // "REFERENCES " + fmt.makeLink(), //  <a href=\"table_" + strTable + ".html\">" + strTable + "</a>(",
-                                        [&fmt](const StringVector &vMatches, string &strReplace)
-                                        {
-                                            const string &strTable = vMatches[1];
-                                            auto pTable = TableComment::Find(strTable);
-                                            if (pTable)
-                                                strReplace = "REFERENCES " + pTable->makeLink(fmt) + "(";
-                                        },
-                                        true);   // fGlobal
-//             }
-
-            str += htmlLine + "\n";
+            // Link the referenced tables; the references are in the order of the lines.
+            size_t ofsDone = 0;
+            for (;
+                 (itRef != _vReferences.end()) && (itRef->iLine == c - 1);
+                 ++itRef)
+                if (itRef->pTarget)
+                {
+                    str += fmt.format(line.substr(ofsDone, itRef->ofs - ofsDone), true) + itRef->pTarget->makeLink(fmt);
+                    ofsDone = itRef->ofs + itRef->strTable.length();
+                }
+
+            str += fmt.format(line.substr(ofsDone), true) + "\n";
         }
         str += fmt.closePRE();
     }
 
+    if (_vReferencedBy.size())
+    {
+        str += fmt.openPara() + fmt.makeBold("Referenced by:") + " ";
+        size_t c = 0;
+        for (const auto &r : _vReferencedBy)
+        {
+            if (c++)
+                str += ", ";
+            str += r.first->makeLink(fmt) + " (" + fmt.format(r.second->strColumns, false) + ")";
+        }
+        str += fmt.closePara();
+    }
+
     return str;
 }
 
@@ -111,15 +111,18 @@ void FormatterHTML::convertFormatting(string &str) /* override */
        permit the following HTML tags by converting &lt;TAG&gt; back to <TAG>: */
     static const StringVector svTags( { "ol", "ul", "li", "b", "i", "code" } );
     static const Regex reTags("&lt;(/?(?:" + implode("|", svTags) + "))&gt;");
-    reTags.findReplace(str, "<$1>", true);
+    static const RegexReplacement replTags("<$1>");
+    reTags.findReplace(str, replTags, true);
 
     static const Regex reCode("`([^`]+)`");
-    reCode.findReplace(str, "<code>$1</code>", true);
+    static const RegexReplacement replCode("<code>$1</code>");
+    reCode.findReplace(str, replCode, true);
 
     // Linkify links.
     static const Regex reLink("(https?://\\S+[^.])");
             // "(?:^|[\\W])((ht|f)tp(s?):\\/\\/|www\\.)(([\\w\\-]+\\.){1,}?([\\w\\-.~]+\\/?)*[\\[a-zA-Z0-9].,%_=?&#\\-+()\\[\\]\\*$~@!:/{};']*)");
-    reLink.findReplace(str, "<a href=\"$1\">$1</a>", true);
+    static const RegexReplacement replLink("<a href=\"$1\">$1</a>");
+    reLink.findReplace(str, replLink, true);
 }
 
 /* virtual */
@@ -234,12 +237,14 @@ void FormatterLatex::convertFormatting(string &str) /* override */
 
     // Markdown
     static const Regex reCode("`([^`]+)`");
-    reCode.findReplace(str, OpenTextTT + "$1" + CloseCurly, true);
+    static const RegexReplacement replCode(OpenTextTT + "$1" + CloseCurly);
+    reCode.findReplace(str, replCode, true);
 
     // Linkify links
     static const Regex reLink("(https?://\\S+)");
             // "(?:^|[\\W])((ht|f)tp(s?):\\/\\/|www\\.)(([\\w\\-]+\\.){1,}?([\\w\\-.~]+\\/?)*[\\[a-zA-Z0-9].,%_=?&#\\-+()\\[\\]\\*$~@!:/{};']*)");
-    reLink.findReplace(str, "\\url{$1}", true);
+    static const RegexReplacement replLink("\\url{$1}");
+    reLink.findReplace(str, replLink, true);
 }
 
 /* virtual */
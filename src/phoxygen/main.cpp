@@ -16,17 +16,25 @@
 #define DEF_STRING_IMPLEMENTATION
 
 #include "xwp/exec.h"
+#include "xwp/dirwalk.h"
+#include "xwp/mappedfile.h"
+#include "xwp/chunkedfile.h"
+#include "xwp/simd.h"
 #include "xwp/debug.h"
 #include "xwp/except.h"
 #include "xwp/regex.h"
+#include "xwp/thread.h"
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <thread>
+#include <condition_variable>
 
 #include "phoxygen/phoxygen.h"
 #include "phoxygen/htmlpage.h"
+#include "phoxygen/scanner.h"
 
 #include <sys/stat.h>
 
@@ -40,6 +48,17 @@
 const string dirHTMLOut = "doc/html";
 const string dirLatexOut = "doc/latex";
 
+// Directories that are skipped when looking for sources, unless --exclude is given.
+const StringVector g_vDefaultExcludes( { "3rdparty", "vendor", "node_modules" } );
+
+// Files from this size on are streamed through a buffer of STREAM_BUFFER_SIZE bytes instead
+// of being loaded in one piece; --stream sets this to 0.
+off_t g_cbStreamThreshold = 64 * 1024 * 1024;
+const size_t STREAM_BUFFER_SIZE = 1024 * 1024;
+
+// Upper limit for -j N.
+const unsigned int MAX_THREADS = 256;
+
 PMainPageComment g_pMainPage;
 
 /***************************************************************************
@@ -82,7 +101,8 @@ string html2Latex(const string &html)
     re13.findReplace(ls, "}/", true);
 
     static const Regex re14(R"i____(<a href="class_([^"]+)\.html">[^<]+<\/a>)i____");
-    re14.findReplace(ls, "\\hyperref[class-$1]{$1}", true);
+    static const RegexReplacement repl14("\\hyperref[class-$1]{$1}");
+    re14.findReplace(ls, repl14, true);
     static const Regex re15(R"i____(<a [^>]+>)i____");
     re15.findReplace(ls, "", true);
     static const Regex re16(R"i____(<\/a>)i____");
@@ -103,316 +123,620 @@ string html2Latex(const string &html)
  *
  **************************************************************************/
 
-void parseSources(StringVector &vFilenames)
+/**
+ *  Collects all PHP files under the given directories into vFilenames, skipping
+ *  directories and files that match one of the exclude globs.
+ */
+void findSources(const StringVector &vDirs,
+                 const StringVector &vExcludes,
+                 StringVector &vFilenames)
+{
+    Debug::Enter(MAIN, "Looking for sources");
+
+    FileFinder ff;
+    ff.addInclude("*.php");
+    for (const auto &strGlob : vExcludes)
+        ff.addExclude(strGlob);
+    ff.run(vDirs, vFilenames);
+
+    Debug::Leave(to_string(vFilenames.size()) + " files found");
+}
+
+/**
+ *  Everything that parseFile() found in one source file.
+ */
+struct ParsedFile
+{
+    vector<PCommentBase>    vObjects;           // In the order in which they were found.
+    string                  strLog;             // Debug output when parsed on a worker thread.
+    std::exception_ptr      pException;
+    bool                    fDone = false;
+};
+
+/**
+ *  Parses one PHP file and stores the comment objects that were found in pf.vObjects,
+ *  in the order in which they were found.
+ *
+ *  This does not touch the global class, table, page and REST API maps, so it can run
+ *  on several files in parallel. The objects are added to the maps by addObjects().
+ *
+ *  Each file is mapped into memory in one go (see MappedFile) and lexed by PhpScanner,
+ *  and the state machine below runs on the string_view lines that it returns, so lines
+ *  are never copied unless something gets stored. Very big files are streamed instead.
+ *
+ *  Since the regexes do not check their input, files must be valid UTF-8. Stray bytes
+ *  in mapped files are converted from Latin-1; streamed files are rejected.
+ */
+void parseFile(const string &strInputFile,
+               ParsedFile &pf)
 {
-    int c = 0;
-    int cFiles = vFilenames.size();
-    for (const auto &strInputFile : vFilenames)
+    int lineno = 0;
+    State state = State::INIT;                  // STATE_* constant
+    int cLinesExamined = 0;
+
+    CommentText textCurrentComment;
+    bool fLineAdded = false;                    // Whether the last doc comment line went into textCurrentComment.
+    int linenoWhereCommentBegan = 0;
+    int linenoWhereCommentEnded = 0;
+    PFunctionComment pLastFunction;
+    PTableComment pLastTable;
+    PClassComment pCurrentClass;
+    PCommentBase pCurrent;                         // Current object. In the event of a \page, this gets set BEFORE the doccomment closes.
+                                        // In the event of a class or function or the like, this gets set AFTER the doccomment closes.
+    // Kept alive by the comments that point into it. Big files are streamed instead, so
+    // that memory use does not grow with the file size; comment lines get copied then.
+    PMappedFile pFile;
+    unique_ptr<ChunkedFile> pChunkedFile;
+    unique_ptr<PhpScanner> pScanner;
+    try
     {
-        ++c;
-
-        cout << "Processing " + to_string(c) + "/" + to_string(cFiles) + ": " + strInputFile + "...\n";
-
-        int lineno = 0;
-        State state = State::INIT;                  // STATE_* constant
-        int cLinesExamined = 0;
-
-        string strCurrentComment = "";
-        int linenoWhereCommentBegan = 0;
-        int linenoWhereCommentEnded = 0;
-        PFunctionComment pLastFunction;
-        PTableComment pLastTable;
-        PClassComment pCurrentClass;
-        PCommentBase pCurrent;                         // Current object. In the event of a \page, this gets set BEFORE the doccomment closes.
-                                            // In the event of a class or function or the like, this gets set AFTER the doccomment closes.
-        ifstream infile(strInputFile);
-        string strCurrentLine;
-        while (getline(infile, strCurrentLine))
+        struct stat st;
+        if (    (0 == ::stat(strInputFile.c_str(), &st))
+             && (st.st_size >= g_cbStreamThreshold)
+           )
         {
-            ++lineno;
+            pChunkedFile = make_unique<ChunkedFile>(strInputFile, STREAM_BUFFER_SIZE, true);
+            pScanner = make_unique<PhpScanner>(*pChunkedFile);
+        }
+        else
+        {
+            pFile = make_shared<MappedFile>(strInputFile);
+
+            // Most files in a big tree have no doc comments at all. Reject those after one
+            // vectorized pass instead of lexing them.
+            if (findString(pFile->view(), "/**") == string_view::npos)
+                return;
+
+            // The regexes skip the UTF-8 check on their input (see Regex), so make sure
+            // here that the file is valid. Stray bytes are taken to be Latin-1.
+            string_view svFile = pFile->view();
+            size_t ofsInvalid = findInvalidUTF8(svFile);
+            if (ofsInvalid != string_view::npos)
+            {
+                size_t lineno = 1 + count(svFile.begin(), svFile.begin() + ofsInvalid, '\n');
+                Debug::Warning(strInputFile + ": invalid UTF-8 at byte offset " + to_string(ofsInvalid) + " (line " + to_string(lineno) + "), converting stray bytes from Latin-1");
+                pFile->assign(makeValidUTF8(svFile));
+            }
 
-            static const Regex s_reCommentOpen(R"i____(^\s*\/\*\*)i____");
-            static const Regex s_reEmptyLine(R"i____(^\s*$)i____");
+            pScanner = make_unique<PhpScanner>(pFile->view());
+        }
+    }
+    catch (FSException &e)
+    {
+        Debug::Warning(e.what());
+        return;
+    }
 
-            if (s_reCommentOpen.matches(strCurrentLine))
-            {
-                /*
-                 * OPENING DOCCOMMENT
-                 */
-                // Ignore them if they have many asterisks.
-                static const Regex s_reCommentIgnore(R"i____(^\s*\/\*\*\*\*\*\*\*)i____");
-                if (s_reCommentIgnore.matches(strCurrentLine))
-                    continue;
+    // The scanner only returns code lines if we need them to find out what the last
+    // doc comment belongs to; blank lines are never returned.
+    ScannedLine line;
+    while (pScanner->next(line, (state != State::INIT)))
+    {
+        lineno = line.lineno;
+        string_view strCurrentLine = line.svLine;
+        if (!line.fContinued)
+            fLineAdded = false;
 
-                // Ignore one-line PHPDoc variable declarations.
-                if (strCurrentLine.find("@var") != string::npos)
-                    continue;
+        if (line.type == ScannedLine::Type::DOC_OPEN)
+        {
+            /*
+             * OPENING DOCCOMMENT
+             */
+            // Ignore one-line PHPDoc variable declarations.
+            if (strCurrentLine.find("@var") != string::npos)
+                continue;
 
-                // Begin doxygen comment:
-                state = State::IN_DOCCOMMENT;
-                strCurrentComment = "";
-                linenoWhereCommentBegan = lineno;
-                Debug::Log(MAIN, "Found opening comment on line $lineno, state=$state");
-            }
-            else if (    (state == State::IN_DOCCOMMENT)
-                      || (state == State::IN_DOCCOMMENT_PAGE)
-                      || (state == State::IN_DOCCOMMENT_MAINPAGE)
-                    )
+            // Begin doxygen comment:
+            state = State::IN_DOCCOMMENT;
+            textCurrentComment = CommentText(pFile);
+            linenoWhereCommentBegan = lineno;
+            Debug::Log(MAIN, "Found opening comment on line $lineno, state=$state");
+        }
+        else if (line.type != ScannedLine::Type::CODE)
+        {
+            if (    (state != State::IN_DOCCOMMENT)
+                 && (state != State::IN_DOCCOMMENT_PAGE)
+                 && (state != State::IN_DOCCOMMENT_MAINPAGE)
+               )
+                // Rest of a comment that is being ignored, see above and below.
+                continue;
+
+            if (line.fContinued)
             {
-                static const Regex s_reCommentClose(R"i____(\*\/)i____");
-                if (s_reCommentClose.matches(strCurrentLine))
+                // Next piece of a line that was too long for the stream buffer. Like on a
+                // shorter line, text before the end of the comment is ignored.
+                if (line.type != ScannedLine::Type::DOC_CLOSE)
                 {
-                    /*
-                     * CLOSING DOCCOMMENT
-                     */
-//                     State oldstate = state;
-                    if (    (state == State::IN_DOCCOMMENT_PAGE)
-                         || (state == State::IN_DOCCOMMENT_MAINPAGE)
-                       )
-                    {
-                        state = State::INIT;
-                        pCurrent->append(strCurrentComment);
-                    }
-                    else
-                    {
-                        state = State::EXAMINE_NEXT_AFTER_DOCCOMMENT;
-                        cLinesExamined = 0;
-                    }
-                    Debug::Log(MAIN, "Found closing comment on line $lineno, state=$oldstate->$state");
-                    linenoWhereCommentEnded = lineno;
+                    if (fLineAdded)
+                        textCurrentComment.continueLine(strCurrentLine);
+                    continue;
                 }
-                // Ignore two-line PHPDoc variable declarations.
-                else if (    (strCurrentComment.empty())
-                          && (strCurrentLine.find("@var") != string::npos)
-                        )
+                if (fLineAdded)
+                    textCurrentComment.removeLastLine();
+            }
+
+            if (line.type == ScannedLine::Type::DOC_CLOSE)
+            {
+                /*
+                 * CLOSING DOCCOMMENT
+                 */
+//                 State oldstate = state;
+                if (    (state == State::IN_DOCCOMMENT_PAGE)
+                     || (state == State::IN_DOCCOMMENT_MAINPAGE)
+                   )
                 {
                     state = State::INIT;
+                    pCurrent->append(textCurrentComment);
                 }
                 else
                 {
-                    static const Regex s_reCommentShrinkleft(R"i____(^\s+\* ?)i____");
-                    string lineTemp = strCurrentLine;
-                    s_reCommentShrinkleft.findReplace(lineTemp, "", false);
+                    state = State::EXAMINE_NEXT_AFTER_DOCCOMMENT;
+                    cLinesExamined = 0;
+                }
+                Debug::Log(MAIN, "Found closing comment on line $lineno, state=$oldstate->$state");
+                linenoWhereCommentEnded = lineno;
+            }
+            // Ignore two-line PHPDoc variable declarations.
+            else if (    (textCurrentComment.empty())
+                      && (strCurrentLine.find("@var") != string::npos)
+                    )
+            {
+                state = State::INIT;
+            }
+            else
+            {
+                string_view lineTemp = CommentText::StripPrefix(strCurrentLine);
 
-                    static const Regex s_reMainPage(R"i____(^\s*[\\@]mainpage\s+(.*))i____");
-                    static const Regex s_rePage(R"i____(^\s*[\\@]page\s+([-_a-zA-Z0-9]+)\s+(.*))i____");
+                static const Regex s_reMainPage(R"i____(^\s*[\\@]mainpage\s+(.*))i____");
+                static const Regex s_rePage(R"i____(^\s*[\\@]page\s+([-_a-zA-Z0-9]+)\s+(.*))i____");
 
-                    RegexMatches aMatches;
-                    if (s_reMainPage.matches(lineTemp, aMatches))
-                    {
-                        const string &strPageTitle = aMatches.get(1);
-
-                        state = State::IN_DOCCOMMENT_MAINPAGE;
-                        Debug::Log(MAIN, "line $linenoWhereCommentBegan: found \\mainpage (state=$state)");
-                        g_pMainPage = make_shared<MainPageComment>(strPageTitle,
-                                                                   strInputFile,
-                                                                   linenoWhereCommentBegan,
-                                                                   linenoWhereCommentEnded);
-                        pCurrent = g_pMainPage;
-                    }
-                    else if (s_rePage.matches(lineTemp, aMatches))
-                    {
-                        const string &pageID = aMatches.get(1);
-                        const string &pageTitle = aMatches.get(2);
+                RegexMatches aMatches;
+                if (s_reMainPage.matches(lineTemp, aMatches))
+                {
+                    const string &strPageTitle = aMatches.get(1);
+
+                    state = State::IN_DOCCOMMENT_MAINPAGE;
+                    Debug::Log(MAIN, "line $linenoWhereCommentBegan: found \\mainpage (state=$state)");
+                    pCurrent = make_shared<MainPageComment>(strPageTitle,
+                                                            strInputFile,
+                                                            linenoWhereCommentBegan,
+                                                            linenoWhereCommentEnded);
+                    pf.vObjects.push_back(pCurrent);
+                }
+                else if (s_rePage.matches(lineTemp, aMatches))
+                {
+                    const string &pageID = aMatches.get(1);
+                    const string &pageTitle = aMatches.get(2);
 
-                        if (pageTitle.empty())
-                            throw FSException("Incomplete \\page in comment beginning at line $lineno");
+                    if (pageTitle.empty())
+                        throw FSException("Incomplete \\page in comment beginning at line $lineno");
 
-                        state = State::IN_DOCCOMMENT_PAGE;
-                        Debug::Log(MAIN, "line $linenoWhereCommentBegan: found \\page $pageID with title \"$pageTitle\" (state=$state)");
+                    state = State::IN_DOCCOMMENT_PAGE;
+                    Debug::Log(MAIN, "line $linenoWhereCommentBegan: found \\page $pageID with title \"$pageTitle\" (state=$state)");
 
-                        auto p = PageComment::Make(pageID,
-                                                   pageTitle,
-                                                   strInputFile,
-                                                   linenoWhereCommentBegan,
-                                                   linenoWhereCommentEnded);
-                        pCurrent = p;
-                    }
-                    else
-                    {
-                        strCurrentComment += lineTemp + "\n";
-                        Debug::Log(MAIN, "Added line: " + lineTemp);
-                    }
+                    auto p = PageComment::Make(pageID,
+                                               pageTitle,
+                                               strInputFile,
+                                               linenoWhereCommentBegan,
+                                               linenoWhereCommentEnded);
+                    pCurrent = p;
+                    pf.vObjects.push_back(p);
+                }
+                else
+                {
+                    textCurrentComment.addLine(strCurrentLine);
+                    fLineAdded = true;
+                    if (g_flDebugSet & MAIN)
+                        Debug::Log(MAIN, "Added line: " + string(lineTemp));
                 }
             }
-            else if (s_reEmptyLine.matches(strCurrentLine))     // Outside comments, ignore empty lines.
-                continue;
-            else if (state == State::EXAMINE_NEXT_AFTER_DOCCOMMENT)
+        }
+        else if (state == State::EXAMINE_NEXT_AFTER_DOCCOMMENT)
+        {
+            // First non-empty line after non-page comment: all declarations are tried in one pass.
+            // The set takes the leftmost match and, at the same offset, the earlier pattern. All
+            // patterns are anchored, so that this is the order in which they used to be tried;
+            // the function one still finds "function" anywhere, as in "$app::Get('/x', function f($a)".
+            enum { DECL_CLASS, DECL_INTERFACE, DECL_FUNCTION, DECL_CREATE_TABLE, DECL_RESTAPI };
+            static const RegexSet s_reDeclarations(
+                {
+                    R"i____(^\s*((?:abstract\s+)?class)\s+(\S+).*)i____",
+                    R"i____(^\s*(interface)\s+(\S+))i____",
+                    R"i____(^(?:.*?\s)?(?:public\s+|private\s+|protected\s+|static\s+)*function\s+([A-Za-z0-9_]+)\s*\((.*))i____",
+                    R"i____(^\s*CREATE\s+TABLE\s+(?:IF\s+NOT\s+EXISTS\s+)?([A-Za-z_]+).*)i____",
+                    R"i____(^\s*\S+::(Get|Post|Put|Delete)\(["'"](.*)["'"],(.*))i____"
+                });
+
+            RegexMatches aMatches;
+            int iDecl = s_reDeclarations.matches(strCurrentLine, aMatches);
+            if (    (iDecl == DECL_CLASS)
+                 || (iDecl == DECL_INTERFACE)
+               )
             {
-                // First non-empty line after non-page comment:
-                static const Regex s_reClass(R"i____(^\s*((?:abstract\s+)?class)\s+(\S+).*)i____");
-                static const Regex s_reInterface(R"i____(^\s*(interface)\s+(\S+))i____");
-                static const Regex s_reFunction(R"i____((?:^|\s+)(?:public\s+|private\s+|protected\s+|static\s+)*function\s+([A-Za-z0-9_]+)\s*\((.*))i____");
-                static const Regex s_reCreateTable(R"i____(^\s*CREATE\s+TABLE\s+(?:IF\s+NOT\s+EXISTS\s+)?([A-Za-z_]+).*)i____");
-                static const Regex s_reRESTAPIDef(R"i____(^\s*\S+::(Get|Post|Put|Delete)\(["'"](.*)["'"],(.*))i____");
+                const string &keyword = aMatches.get(1);
+                const string &identifier = aMatches.get(2);
 
-                RegexMatches aMatches;
-                if (    (s_reClass.matches(strCurrentLine, aMatches))
-                     || (s_reInterface.matches(strCurrentLine, aMatches))
-                   )
+                /*
+                 * STORE CLASS
+                 */
+                Debug::Enter(MAIN, "line " + to_string(linenoWhereCommentBegan) + ": found " + keyword  + " " + identifier);
+
+                auto p = ClassComment::Make(keyword,
+                                            identifier,
+                                            textCurrentComment,
+                                            strInputFile,
+                                            linenoWhereCommentBegan,
+                                            linenoWhereCommentEnded);
+                pCurrent = p;
+                pf.vObjects.push_back(p);
+                StringVector llParents;
+
+                static const Regex s_reImplements(R"i____(^\s*class\s+\S+\s+implements\s+(\S+))i____");
+                static const Regex s_reSplitComma(R"i____(\s*,\s*)i____");
+
+                if (s_reImplements.matches(strCurrentLine, aMatches))
                 {
-                    const string &keyword = aMatches.get(1);
-                    const string &identifier = aMatches.get(2);
-
-                    /*
-                     * STORE CLASS
-                     */
-                    Debug::Enter(MAIN, "line " + to_string(linenoWhereCommentBegan) + ": found " + keyword  + " " + identifier);
-
-                    auto p = ClassComment::Make(keyword,
-                                                identifier,
-                                                strCurrentComment,
-                                                strInputFile,
-                                                linenoWhereCommentBegan,
-                                                linenoWhereCommentEnded);
-                    pCurrent = p;
-                    StringVector llParents;
-
-                    static const Regex s_reImplements(R"i____(^\s*class\s+\S+\s+implements\s+(\S+))i____");
-                    static const Regex s_reSplitComma(R"i____(\s*,\s*)i____");
-
-                    if (s_reImplements.matches(strCurrentLine, aMatches))
+                    const string &strImplements = aMatches.get(1);
+                    StringVector sv;
+                    s_reSplitComma.split(strImplements, sv);
+                    for (const auto &s : sv)
                     {
-                        const string &strImplements = aMatches.get(1);
-                        StringVector sv;
-                        s_reSplitComma.split(strImplements, sv);
-                        for (const auto &s : sv)
-                        {
-                            p->addImplements(s);
-                            llParents.push_back(s);
-                        }
+                        p->addImplements(s);
+                        llParents.push_back(s);
                     }
+                }
 
-                    static const Regex s_reExtends(R"i____(^\s*(?:abstract\s+)?(?:class|interface)\s+\S+\s+extends\s+(\S+))i____");
-                    if (s_reExtends.matches(strCurrentLine, aMatches))
+                static const Regex s_reExtends(R"i____(^\s*(?:abstract\s+)?(?:class|interface)\s+\S+\s+extends\s+(\S+))i____");
+                if (s_reExtends.matches(strCurrentLine, aMatches))
+                {
+                    const string &strExtends = aMatches.get(1);
+                    StringVector sv;
+                    s_reSplitComma.split(strExtends, sv);
+                    for (const auto &s : sv)
                     {
-                        const string &strExtends = aMatches.get(1);
-                        StringVector sv;
-                        s_reSplitComma.split(strExtends, sv);
-                        for (const auto &s : sv)
-                        {
-                            p->addExtends(s);
-                            llParents.push_back(s);
-                        }
+                        p->addExtends(s);
+                        llParents.push_back(s);
                     }
+                }
 
-                    for (const auto &s : llParents)
-                        p->addParent(s);
+                for (const auto &s : llParents)
+                    p->addParent(s);
 
-                    pCurrentClass = p;
-                    state = State::INIT;
+                pCurrentClass = p;
+                state = State::INIT;
 
-                    // my $exts = ($pCurrent->extends) ? ', extends "'.$pCurrent->extends.'"' : '';
-                    // my $impl = ($pCurrent->implements) ? ', implements "'.$pCurrent->implements.'"' : '';
-                    Debug::Leave();
-                }
-                else if (s_reFunction.matches(strCurrentLine, aMatches))
+                // my $exts = ($pCurrent->extends) ? ', extends "'.$pCurrent->extends.'"' : '';
+                // my $impl = ($pCurrent->implements) ? ', implements "'.$pCurrent->implements.'"' : '';
+                Debug::Leave();
+            }
+            else if (iDecl == DECL_FUNCTION)
+            {
+                // Views into strCurrentLine, which survive the next match with aMatches.
+                string_view svIdentifier = aMatches.view(1);
+                string_view svAfterOpeningBracket = aMatches.view(2);
+
+                /*
+                 * STORE FUNCTION
+                 */
+                if (g_flDebugSet & MAIN)
+                    Debug::Log(MAIN, "line " + to_string(linenoWhereCommentBegan) + ": found function " + string(svIdentifier) + ", afterOpeningBracket=" + string(svAfterOpeningBracket));
+
+                static const Regex s_reFunctionKeyword(R"i____(^\s*(.*function).*)i____");
+                s_reFunctionKeyword.matches(strCurrentLine, aMatches);
+                const string &keyword = aMatches.get(1);
+
+                auto p = make_shared<FunctionComment>(keyword,
+                                                      string(svIdentifier),
+                                                      textCurrentComment,
+                                                      strInputFile,
+                                                      linenoWhereCommentBegan,
+                                                      linenoWhereCommentEnded);
+                pLastFunction = p;
+                pCurrent = p;
+                pf.vObjects.push_back(p);
+
+                if (pCurrentClass)
                 {
-                    string identifier = aMatches.get(1);
-                    string afterOpeningBracket = aMatches.get(2);
-
-                    /*
-                     * STORE FUNCTION
-                     */
-                    Debug::Log(MAIN, "line " + to_string(linenoWhereCommentBegan) + ": found function " + identifier + ", afterOpeningBracket=" + afterOpeningBracket);
-
-                    static const Regex s_reFunctionKeyword(R"i____(^\s*(.*function).*)i____");
-                    s_reFunctionKeyword.matches(strCurrentLine, aMatches);
-                    const string &keyword = aMatches.get(1);
-
-                    auto p = make_shared<FunctionComment>(keyword,
-                                                          identifier,
-                                                          strCurrentComment,
-                                                          strInputFile,
-                                                          linenoWhereCommentBegan,
-                                                          linenoWhereCommentEnded);
-                    pLastFunction = p;
-                    pCurrent = p;
+                    // Member function: two-way linking.
+                    pLastFunction->setClass(pCurrentClass);
+                    pCurrentClass->addMember(pLastFunction);
+                }
 
-                    if (pCurrentClass)
-                    {
-                        // Member function: two-way linking.
-                        pLastFunction->setClass(pCurrentClass);
-                        pCurrentClass->addMember(pLastFunction);
-                    }
+                pLastFunction->parseArguments(svAfterOpeningBracket,
+                                              state);
+            }
+            else if (iDecl == DECL_CREATE_TABLE)
+            {
+                const string &identifier = aMatches.get(1);
+                /*
+                 * STORE TABLE
+                 */
+                Debug::Log(MAIN, "line $linenoWhereCommentBegan: found table $identifier");
+
+                auto p = TableComment::Make(identifier,
+                                            textCurrentComment,
+                                            strInputFile,
+                                            linenoWhereCommentBegan,
+                                            linenoWhereCommentEnded);
+                pLastTable = p;
+                pCurrent = p;
+                pf.vObjects.push_back(p);
+                state = State::IN_CREATE_TABLE;
 
-                    pLastFunction->parseArguments(afterOpeningBracket,
-                                                  state);
-                }
-                else if (s_reCreateTable.matches(strCurrentLine, aMatches))
+                pLastTable->processInputLine(strCurrentLine, state);
+            }
+            else if (iDecl == DECL_RESTAPI)
+            {
+                /*
+                 *  STORE REST API
+                 */
+                const string &method = aMatches.get(1);     // mixed case!
+                string_view svNameAndArgs = aMatches.view(2); // ) = /^\s*\S+::(Get|Post|Put|Delete)\(["'"](.*)["'"],/ )
+
+                static const Regex s_reRESTAPIArgs(R"i____(\/([^\/]+)(\/.*)?)i____");
+                RegexMatches aMatches2;
+                if (!s_reRESTAPIArgs.matches(svNameAndArgs, aMatches2))
+                    Debug::Warning("wonky REST API args \"" + string(svNameAndArgs) + "\"");
+                else
                 {
-                    const string &identifier = aMatches.get(1);
-                    /*
-                     * STORE TABLE
-                     */
-                    Debug::Log(MAIN, "line $linenoWhereCommentBegan: found table $identifier");
-
-                    auto p = TableComment::Make(identifier,
-                                                strCurrentComment,
-                                                strInputFile,
-                                                linenoWhereCommentBegan,
-                                                linenoWhereCommentEnded);
-                    pLastTable = p;
+                    const string &name = aMatches2.get(1);
+                    const string &args = (aMatches2.size() > 1) ? aMatches2.get(2) : "";
+                    auto p = RESTComment::Make(method,
+                                               name,
+                                               args,
+                                               textCurrentComment,
+                                               strInputFile,
+                                               linenoWhereCommentBegan,
+                                               linenoWhereCommentEnded);
                     pCurrent = p;
-                    state = State::IN_CREATE_TABLE;
+                    pf.vObjects.push_back(p);
 
-                    pLastTable->processInputLine(strCurrentLine, state);
+                    Debug::Log(MAIN, "line " + to_string(linenoWhereCommentBegan) + ": found REST API " + p->getIdentifier());
                 }
-                else if (s_reRESTAPIDef.matches(strCurrentLine, aMatches))
+
+                state = State::INIT;
+
+                // $pLastTable->processInputLine($_, \$state);
+            }
+            else if (cLinesExamined < 2)
+            {
+                ++cLinesExamined;
+            }
+            else
+            {
+                Debug::Warning("don't know what to do with comment in " + strInputFile + " (lines " + to_string(linenoWhereCommentBegan) + "--" + to_string(linenoWhereCommentEnded) + ")");
+                state = State::INIT;
+            }
+        }
+        else if (state == State::IN_FUNCTION_HEADER)
+        {
+            // Continuing function header:
+            pLastFunction->parseArguments(strCurrentLine, state);
+        }
+        else if (state == State::IN_CREATE_TABLE)
+        {
+            pLastTable->processInputLine(strCurrentLine, state);
+        }
+    }
+
+    if (    (pChunkedFile)
+         && (pChunkedFile->getInvalidUTF8Offset() != string_view::npos)
+       )
+    {
+        // The scanner stopped there as if the file ended, so throw away what we have.
+        Debug::Warning(strInputFile + ": invalid UTF-8 at byte offset " + to_string(pChunkedFile->getInvalidUTF8Offset()) + ", ignoring the file");
+        pf.vObjects.clear();
+        return;
+    }
+
+    // Parse the CREATE TABLE statements here, so that this happens on the worker threads too.
+    for (auto &pObject : pf.vObjects)
+        if (pObject->getType() == CommentBase::Type::TABLE)
+            static_pointer_cast<TableComment>(pObject)->parseDefinition();
+}
+
+/**
+ *  Adds the objects that parseFile() found to the global maps. This must be called
+ *  for the files in command line order, because later definitions of the same name
+ *  replace earlier ones.
+ */
+void addObjects(ParsedFile &pf)
+{
+    for (auto &pObject : pf.vObjects)
+    {
+        switch (pObject->getType())
+        {
+            case CommentBase::Type::MAINPAGE:
+                g_pMainPage = static_pointer_cast<MainPageComment>(pObject);
+            break;
+
+            case CommentBase::Type::PAGE:
+                PageComment::Add(static_pointer_cast<PageComment>(pObject));
+            break;
+
+            case CommentBase::Type::CLASS:
+                ClassComment::Add(static_pointer_cast<ClassComment>(pObject));
+            break;
+
+            case CommentBase::Type::FUNCTION:
+                FunctionComment::Add(static_pointer_cast<FunctionComment>(pObject));
+            break;
+
+            case CommentBase::Type::TABLE:
+                TableComment::Add(static_pointer_cast<TableComment>(pObject));
+            break;
+
+            case CommentBase::Type::REST:
+                RESTComment::Add(static_pointer_cast<RESTComment>(pObject));
+            break;
+        }
+    }
+
+    pf.vObjects.clear();
+}
+
+/**
+ *  Parses all the given PHP files and fills the class, table, page and REST API maps.
+ *
+ *  With cThreads > 1, the files are parsed by that many worker threads. The biggest files are handed out first so that one large file at the end
+ *  of the list does not hold up the rest. The results are still added to the maps in
+ *  the order of vFilenames, and the debug output of each file is printed in that order
+ *  too, so the output is the same as with a single thread.
+ */
+void parseSources(const StringVector &vFilenames,
+                  unsigned int cThreads)
+{
+    size_t cFiles = vFilenames.size();
+    vector<ParsedFile> vParsed(cFiles);
+
+    if (cThreads > cFiles)
+        cThreads = cFiles;
+
+    if (cThreads <= 1)
+    {
+        for (size_t u = 0;
+             u < cFiles;
+             ++u)
+        {
+            cout << "Processing " + to_string(u + 1) + "/" + to_string(cFiles) + ": " + vFilenames[u] + "...\n";
+            parseFile(vFilenames[u], vParsed[u]);
+            addObjects(vParsed[u]);
+        }
+    }
+    else
+    {
+        // Hand out the files biggest first.
+        vector<size_t> vOrder(cFiles);
+        vector<off_t> vSizes(cFiles, 0);
+        for (size_t u = 0;
+             u < cFiles;
+             ++u)
+        {
+            vOrder[u] = u;
+            struct stat st;
+            if (0 == ::stat(vFilenames[u].c_str(), &st))
+                vSizes[u] = st.st_size;
+        }
+        stable_sort(vOrder.begin(),
+                    vOrder.end(),
+                    [&vSizes](size_t u1, size_t u2)
+                    {
+                        return vSizes[u1] > vSizes[u2];
+                    });
+
+        std::atomic<size_t> iNext(0);
+        std::mutex m;
+        std::condition_variable cv;
+
+        vector<std::thread> vThreads;
+        for (unsigned int t = 0;
+             t < cThreads;
+             ++t)
+            vThreads.push_back(std::thread([&]()
+            {
+                size_t i;
+                while ((i = iNext++) < cFiles)
                 {
-                    /*
-                     *  STORE REST API
-                     */
-                    const string &method = aMatches.get(1);     // mixed case!
-                    const string &nameAndArgs = aMatches.get(2); // ) = /^\s*\S+::(Get|Post|Put|Delete)\(["'"](.*)["'"],/ )
-
-                    static const Regex s_reRESTAPIArgs(R"i____(\/([^\/]+)(\/.*)?)i____");
-                    RegexMatches aMatches2;
-                    if (!s_reRESTAPIArgs.matches(nameAndArgs, aMatches2))
-                        Debug::Warning("wonky REST API args \"" + nameAndArgs + "\"");
-                    else
+                    ParsedFile &pf = vParsed[vOrder[i]];
                     {
-                        const string &name = aMatches2.get(1);
-                        const string &args = (aMatches2.size() > 1) ? aMatches2.get(2) : "";
-                        auto p = RESTComment::Make(method,
-                                                   name,
-                                                   args,
-                                                   strCurrentComment,
-                                                   strInputFile,
-                                                   linenoWhereCommentBegan,
-                                                   linenoWhereCommentEnded);
-                        pCurrent = p;
-
-                        Debug::Log(MAIN, "line " + to_string(linenoWhereCommentBegan) + ": found REST API " + p->getIdentifier());
+                        DebugCapture capture(pf.strLog);
+                        try
+                        {
+                            parseFile(vFilenames[vOrder[i]], pf);
+                        }
+                        catch (...)
+                        {
+                            pf.pException = std::current_exception();
+                        }
                     }
 
-                    state = State::INIT;
-
-                    // $pLastTable->processInputLine($_, \$state);
-                }
-                else if (cLinesExamined < 2)
-                {
-                    ++cLinesExamined;
+                    std::lock_guard<std::mutex> lock(m);
+                    pf.fDone = true;
+                    cv.notify_all();
                 }
-                else
-                {
-                    Debug::Warning("don't know what to do with comment in " + strInputFile + " (lines " + to_string(linenoWhereCommentBegan) + "--" + to_string(linenoWhereCommentEnded) + ")");
-                    state = State::INIT;
-                }
-            }
-            else if (state == State::IN_FUNCTION_HEADER)
+            }));
+
+        // Merge the results in order while the workers are still busy with later files.
+        std::exception_ptr pException;
+        for (size_t u = 0;
+             u < cFiles;
+             ++u)
+        {
+            ParsedFile &pf = vParsed[u];
             {
-                // Continuing function header:
-                pLastFunction->parseArguments(strCurrentLine, state);
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&pf]() { return pf.fDone; });
             }
-            else if (state == State::IN_CREATE_TABLE)
+
+            cout << "Processing " + to_string(u + 1) + "/" + to_string(cFiles) + ": " + vFilenames[u] + "...\n";
+            cout << pf.strLog;
+            if ((pException = pf.pException))
             {
-                pLastTable->processInputLine(strCurrentLine, state);
+                // Stop handing out files and let the workers finish before rethrowing.
+                iNext = cFiles;
+                break;
             }
+            addObjects(pf);
         }
+
+        for (auto &t : vThreads)
+            t.join();
+
+        if (pException)
+            std::rethrow_exception(pException);
     }
 
-    cout << c << " files processed.\n";
+    cout << cFiles << " files processed.\n";
+}
+
+/**
+ *  Connects everything that refers to something else, once all files have been parsed:
+ *  table references, parameter types, the class hierarchy, and the \refs and REST API
+ *  references in every comment that gets written. Everything that can be warned about
+ *  is warned about here, so that the write*() functions below only read the comments.
+ */
+void resolveReferences()
+{
+    if (!g_pMainPage)
+        g_pMainPage = make_shared<MainPageComment>("Missing \\mainpage (not yet written)", "", 0, 0);
+
+    TableComment::ResolveReferences();
+    FunctionComment::LinkifyAllParams();
+    ClassComment::ResolveParents();
+
+    g_pMainPage->resolveRefs();
+    for (auto it : PageComment::GetAll())
+        it.second->resolveRefs();
+    for (auto it : RESTComment::GetAll())
+        it.second->resolveRefs();
+    for (auto it : TableComment::GetAll())
+        it.second->resolveRefs();
+    for (auto it : ClassComment::GetAll())
+    {
+        it.second->resolveRefs();
+        for (auto pMember : it.second->getMembers())
+            pMember->resolveRefs();
+    }
 }
 
 void writePages(LatexWriter &lxw)
@@ -424,9 +748,6 @@ void writePages(LatexWriter &lxw)
      *  MAIN PAGE
      */
     Debug::Enter(MAIN, "Writing main page");
-    if (!g_pMainPage)
-        g_pMainPage = make_shared<MainPageComment>("Missing \\mainpage (not yet written)", "", 0, 0);
-
     HTMLWriter::Write(dirHTMLOut,
                       "index.html",
                       g_pMainPage->getTitle(OutputMode::PLAINTEXT),
@@ -599,28 +920,6 @@ void writeClasses(LatexWriter &lxw)
     string htmlBody = "<h1>" + strTitle + "</h1>\n\n";
     string htmlThis = "<ul>";
 
-    // Resolve children.
-    StringSet stClassesWithBrokenParents;
-    for (auto it : ClassComment::GetAll())
-    {
-        const string &strClass = it.first;
-        auto pClass = it.second;
-
-        for (const auto &strParent : pClass->getParents())
-        {
-            auto pParent = ClassComment::Find(strParent);
-            if (pParent)
-            {
-                pParent->addChild(pClass);
-            }
-            else
-            {
-                Debug::Warning("Ignoring unknown parent class \"" + strParent + "\" of class \"" + strClass + "\"");
-                stClassesWithBrokenParents.insert(strClass);
-            }
-        }
-    }
-
     // Loop through all classes which have NO PARENT and list children thereunder.
     for (auto it : ClassComment::GetAll())
     {
@@ -629,7 +928,7 @@ void writeClasses(LatexWriter &lxw)
         auto pClass = it.second;
         size_t cParents = pClass->getParents().size();
         Debug::Log(MAIN, to_string(cParents) + " parents");
-        if (!cParents || STL_EXISTS(stClassesWithBrokenParents, strClass))
+        if (!cParents || pClass->hasUnknownParents())
             htmlThis +=   "<li>"
                         + pClass->makeLink(fmtHTML,
                                            strClass,
@@ -739,39 +1038,86 @@ int main(int argc, char **argv)
     exec("mkdir -p " + dirLatexOut);
 
     StringVector vFilenames;
-
-    struct stat s;
-    for (int i = 1;
-         i < argc;
-         ++i)
+    StringVector vDirs;
+    StringVector vExcludes;
+    unsigned int cThreads = 1;
+#ifdef XWP_REGEX_STATS
+    bool fRegexStats = false;
+#endif
+
+    // Bad arguments are reported as a usage error, not as an unhandled exception.
+    try
     {
-        string strArg(argv[i]);
-        if (strArg[0] == '-')
+        struct stat s;
+        for (int i = 1;
+             i < argc;
+             ++i)
         {
-            if (strArg == "-v")
-                g_flDebugSet = 0xFFFF;
+            string strArg(argv[i]);
+            if (strArg[0] == '-')
+            {
+                if (strArg == "-v")
+                    g_flDebugSet = 0xFFFF;
+                else if (strArg == "--stream")
+                    g_cbStreamThreshold = 0;
+                else if (strArg == "--regex-stats")
+                {
+#ifdef XWP_REGEX_STATS
+                    Regex::EnableStats();
+                    fRegexStats = true;
+#else
+                    Debug::Warning("--regex-stats is not available in this build; rebuild with XWP_REGEX_STATS defined");
+#endif
+                }
+                else if (startsWith(strArg, "--exclude="))
+                    vExcludes.push_back(strArg.substr(10));
+                else if (startsWith(strArg, "-j"))
+                {
+                    // -j N or -jN.
+                    string strThreads = strArg.substr(2);
+                    if (strThreads.empty() && (i + 1 < argc))
+                        strThreads = argv[++i];
+                    unsigned long ul = 0;
+                    if (    (!strThreads.empty())
+                         && (strThreads.find_first_not_of("0123456789") == string::npos)
+                         && (strThreads.length() <= 3)
+                       )
+                        ul = strtoul(strThreads.c_str(), nullptr, 10);
+                    if (    (ul < 1)
+                         || (ul > MAX_THREADS)
+                       )
+                        throw FSException("invalid thread count " + quote(strThreads) + " in argument " + strArg + "; must be between 1 and " + to_string(MAX_THREADS));
+                    cThreads = (unsigned int)ul;
+                }
+            }
+            else if (0 == ::stat(strArg.c_str(), &s))
+            {
+                if (S_ISDIR(s.st_mode))
+                    vDirs.push_back(strArg);
+                else
+                    vFilenames.push_back(strArg);
+            }
+            else
+                throw FSException("don't know what to do with argument " + strArg);
         }
-        else if (0 == ::stat(strArg.c_str(), &s))
-            vFilenames.push_back(strArg);
-        else
-            throw FSException("don't know what to do with argument " + strArg);
     }
-
-    if (vFilenames.empty())
+    catch (FSException &e)
     {
-        string strFiles = exec("find -L . -name \"*.php\" -not -path \"./3rdparty/*\" -not -path \"./htdocs/3rdparty/*\"");
-        for (const auto &strLine : explodeVector(strFiles, "\n"))
-        {
-            if (    (strLine.find("/3rdparty/") != string::npos)
-                 || (strLine.find("/vendor/") != string::npos)
-                 || (strLine.find("/node_modules/") != string::npos)
-               )
-                continue;
-            vFilenames.push_back(strLine);
-        }
+        cerr << "phoxygen: " << e.what() << "\n";
+        return 2;
     }
 
-    parseSources(vFilenames);
+    if (vFilenames.empty() && vDirs.empty())
+        vDirs.push_back(".");
+
+    if (!vDirs.empty())
+        findSources(vDirs,
+                    (vExcludes.empty()) ? g_vDefaultExcludes : vExcludes,
+                    vFilenames);
+
+    parseSources(vFilenames, cThreads);
+
+    resolveReferences();
 
     // Constructor opens, destructor closes.
     LatexWriter lxw(dirLatexOut);
@@ -780,5 +1126,10 @@ int main(int argc, char **argv)
     writeRESTAPIs(lxw);
     writeTables(lxw);
     writeClasses(lxw);
+
+#ifdef XWP_REGEX_STATS
+    if (fRegexStats)
+        Regex::DumpStats();
+#endif
 }
 
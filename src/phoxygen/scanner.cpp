@@ -0,0 +1,504 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#include "phoxygen/scanner.h"
+
+#include "xwp/stringhelp.h"
+#include "xwp/simd.h"
+#include "xwp/except.h"
+#include "xwp/debug.h"
+
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+
+inline bool isHorizontalSpace(char c)
+{
+    return (c == ' ') || (c == '\t');
+}
+
+/**
+ *  Returns true if the line is empty or has only white space, like /^\s*$/.
+ */
+bool isBlank(string_view svLine)
+{
+    for (char c : svLine)
+        if (!isspace((unsigned char)c))
+            return false;
+
+    return true;
+}
+
+/**
+ *  Returns the label if a heredoc or nowdoc starts at ofs, which must point to "<<<".
+ *  The label must be followed by the end of the line.
+ */
+string_view getHeredocLabel(string_view svLine,
+                            size_t ofs)
+{
+    size_t i = ofs + 3;
+    size_t cb = svLine.length();
+    while ((i < cb) && (isHorizontalSpace(svLine[i])))
+        ++i;
+
+    char cQuote = 0;
+    if ((i < cb) && ((svLine[i] == '"') || (svLine[i] == '\'')))
+        cQuote = svLine[i++];
+
+    size_t ofsLabel = i;
+    if ((i < cb) && (!isdigit((unsigned char)svLine[i])))
+        while ((i < cb) && (isIdentifierChar(svLine[i])))
+            ++i;
+    if (i == ofsLabel)
+        return string_view();
+    string_view svLabel = svLine.substr(ofsLabel, i - ofsLabel);
+
+    if (cQuote)
+    {
+        if ((i == cb) || (svLine[i] != cQuote))
+            return string_view();
+        ++i;
+    }
+
+    if (!isBlank(svLine.substr(i)))
+        return string_view();
+
+    return svLabel;
+}
+
+// How far lexLine() may look ahead of the byte it is at, e.g. for "<?php ". In a piece of
+// a long line, it stops this far before the end.
+const size_t LOOKAHEAD = 8;
+
+PhpScanner::PhpScanner(string_view svFile)
+    : _svFile(svFile)
+{ }
+
+PhpScanner::PhpScanner(ChunkedFile &file)
+    : _pChunked(&file)
+{
+    // Pieces of long lines are a full buffer, less a few bytes of incomplete UTF-8, and
+    // lexLine() must get past the lookahead in them to make progress.
+    if (file.capacity() < 2 * LOOKAHEAD)
+        throw FSException("buffer of " + to_string(file.capacity()) + " bytes is too small for scanning");
+}
+
+/**
+ *  Runs the lexer over one line (without the newline) and updates the context. Returns
+ *  true if a doc comment starts at the beginning of the line. If a doc comment ends on
+ *  the line, ofsDocClose receives the offset of its closing asterisk, otherwise npos.
+ *
+ *  In streaming mode, svLine can also be a piece of a line that does not fit into the
+ *  buffer, and fComplete is false then. The lexer stops where a token could continue in
+ *  the next piece; cbLexed receives how far it got, and the caller passes the rest in
+ *  again at the start of the next piece.
+ */
+bool PhpScanner::lexLine(string_view svLine,
+                         bool fComplete,
+                         size_t &ofsDocClose,
+                         size_t &cbLexed)
+{
+    const char *p = svLine.data();
+    size_t cb = svLine.length();
+    size_t cbSafe =   (fComplete) ? cb
+                    : (cb > LOOKAHEAD) ? cb - LOOKAHEAD
+                    : 0;
+    size_t i = 0;
+    bool fDocOpen = false;
+    ofsDocClose = string_view::npos;
+
+    if (!_fLineStart)
+        ;
+    else if (_ctx == Context::HEREDOC)
+    {
+        // The closing label may be indented since PHP 7.3.
+        while ((i < cb) && (isHorizontalSpace(p[i])))
+            ++i;
+        size_t cbLabel = _strHeredocLabel.length();
+        if (    (svLine.substr(i, cbLabel) != _strHeredocLabel)
+             || ((i + cbLabel < cb) && (isIdentifierChar(p[i + cbLabel])))
+           )
+        {
+            cbLexed = cb;
+            return false;
+        }
+
+        _ctx = Context::CODE;
+        i += cbLabel;
+    }
+    else if (_ctx == Context::CODE)
+    {
+        // Doc comments must be the first thing on the line. Like before, ignore those with
+        // seven or more asterisks, which are usually separators, and empty ones.
+        size_t j = i;
+        while ((j < cb) && (isspace((unsigned char)p[j])))
+            ++j;
+        if (svLine.substr(j, 3) == "/**")
+        {
+            size_t cStars = 0;
+            while ((j + 1 + cStars < cb) && (p[j + 1 + cStars] == '*'))
+                ++cStars;
+            if (    (cStars < 7)
+                 && (svLine.substr(j, 4) != "/**/")
+               )
+            {
+                _ctx = Context::DOC_COMMENT;
+                fDocOpen = true;
+                i = j + 3;
+            }
+        }
+    }
+
+    while (i < cbSafe)
+    {
+        char c = p[i];
+        switch (_ctx)
+        {
+            case Context::HTML:
+                if (    (c == '<')
+                     && (i + 1 < cb)
+                     && (p[i + 1] == '?')
+                   )
+                {
+                    // <?=, <?php and short open tags; not <?xml.
+                    if ((i + 2 < cb) && (p[i + 2] == '='))
+                    {
+                        _ctx = Context::CODE;
+                        i += 3;
+                        continue;
+                    }
+                    if (    (i + 5 <= cb)
+                         && (!strncasecmp(p + i + 2, "php", 3))
+                         && ((i + 5 == cb) || (isspace((unsigned char)p[i + 5])))
+                       )
+                    {
+                        _ctx = Context::CODE;
+                        i += 5;
+                        continue;
+                    }
+                    if ((i + 2 == cb) || (isspace((unsigned char)p[i + 2])))
+                    {
+                        _ctx = Context::CODE;
+                        i += 2;
+                        continue;
+                    }
+                }
+                ++i;
+            break;
+
+            case Context::CODE:
+                if (    ((c == '#') && (!((i + 1 < cb) && (p[i + 1] == '['))))     // "#[" is a PHP 8 attribute.
+                     || ((c == '/') && (i + 1 < cb) && (p[i + 1] == '/'))
+                   )
+                {
+                    _ctx = Context::LINE_COMMENT;
+                    i += (c == '#') ? 1 : 2;
+                    continue;
+                }
+
+                switch (c)
+                {
+                    case '\'':
+                        _ctx = Context::SINGLE_QUOTED;
+                    break;
+
+                    case '"':
+                        _ctx = Context::DOUBLE_QUOTED;
+                    break;
+
+                    case '`':
+                        _ctx = Context::BACKTICK;
+                    break;
+
+                    case '/':
+                        if ((i + 1 < cb) && (p[i + 1] == '*'))
+                        {
+                            _ctx = Context::BLOCK_COMMENT;
+                            i += 2;
+                            continue;
+                        }
+                    break;
+
+                    case '?':
+                        if ((i + 1 < cb) && (p[i + 1] == '>'))
+                        {
+                            _ctx = Context::HTML;
+                            i += 2;
+                            continue;
+                        }
+                    break;
+
+                    case '<':
+                        if (svLine.substr(i, 3) == "<<<")
+                        {
+                            string_view svLabel = getHeredocLabel(svLine, i);
+                            if (!svLabel.empty())
+                            {
+                                // The heredoc starts on the next line.
+                                _ctx = Context::HEREDOC;
+                                _strHeredocLabel = string(svLabel);
+                                i = cb;
+                                continue;
+                            }
+                            i += 3;
+                            continue;
+                        }
+                    break;
+                }
+                ++i;
+            break;
+
+            case Context::LINE_COMMENT:
+            {
+                // Line comments end at the end of the line or at "?>".
+                size_t q = svLine.find("?>", i);
+                if (q == string_view::npos)
+                {
+                    // Keep the last byte of a piece in case it is the "?".
+                    i = (fComplete) ? cb : cb - 1;
+                    continue;
+                }
+                _ctx = Context::HTML;
+                i = q + 2;
+            }
+            break;
+
+            case Context::SINGLE_QUOTED:
+            case Context::DOUBLE_QUOTED:
+            case Context::BACKTICK:
+                if (c == '\\')
+                    i += 2;
+                else
+                {
+                    if (    ((c == '\'') && (_ctx == Context::SINGLE_QUOTED))
+                         || ((c == '"') && (_ctx == Context::DOUBLE_QUOTED))
+                         || ((c == '`') && (_ctx == Context::BACKTICK))
+                       )
+                        _ctx = Context::CODE;
+                    ++i;
+                }
+            break;
+
+            case Context::BLOCK_COMMENT:
+            case Context::DOC_COMMENT:
+            {
+                size_t q = svLine.find("*/", i);
+                if (q == string_view::npos)
+                {
+                    // Keep the last byte of a piece in case it is the asterisk.
+                    i = (fComplete) ? cb : cb - 1;
+                    continue;
+                }
+                if (_ctx == Context::DOC_COMMENT)
+                    ofsDocClose = q;
+                _ctx = Context::CODE;
+                i = q + 2;
+            }
+            break;
+
+            case Context::HEREDOC:
+                // Only changes at the start of a line.
+                i = cb;
+            break;
+        }
+    }
+
+    if (    (fComplete)
+         && (_ctx == Context::LINE_COMMENT)
+       )
+        _ctx = Context::CODE;
+
+    cbLexed = (fComplete) ? cb : std::min(i, cb);
+    return fDocOpen;
+}
+
+/**
+ *  In streaming mode, drops the part of the buffer before _ofs and reads more of the file.
+ *  Returns false if nothing more could be read, because the end of the file has been
+ *  reached, or because the buffer is full with one long line.
+ */
+bool PhpScanner::refill()
+{
+    if (!_pChunked)
+        return false;
+
+    _pChunked->consume(_ofs);
+    _ofs = 0;
+    size_t cbRead = _pChunked->read();
+    _svFile = _pChunked->view();
+    return (cbRead > 0);
+}
+
+/**
+ *  Jumps from the start of the current line to the start of the next line that might
+ *  change the context or start a doc comment, counting the lines in between. Called by
+ *  next() when the caller does not want code lines. Lines in doc comments are always
+ *  returned, so nothing is skipped there; neither is anything in the middle of a long
+ *  line in streaming mode.
+ */
+void PhpScanner::skipQuietLines()
+{
+    if (!_fLineStart)
+        return;
+
+    // The bytes that lexLine() can react to in each context.
+    string_view svSet;
+    switch (_ctx)
+    {
+        case Context::HTML:             svSet = "<"; break;
+        case Context::CODE:             svSet = "/#'\"`?<"; break;
+        case Context::SINGLE_QUOTED:    svSet = "\\'"; break;
+        case Context::DOUBLE_QUOTED:    svSet = "\\\""; break;
+        case Context::BACKTICK:         svSet = "\\`"; break;
+        case Context::HEREDOC:          svSet = string_view(_strHeredocLabel).substr(0, 1); break;
+        case Context::BLOCK_COMMENT:    svSet = "/"; break;
+        case Context::LINE_COMMENT:
+        case Context::DOC_COMMENT:      return;
+    }
+
+    while (1)
+    {
+        size_t cNewlines, ofsLineStart;
+        size_t ofsFound = findFirstOfCountingLines(_svFile.substr(_ofs),
+                                                   svSet,
+                                                   cNewlines,
+                                                   ofsLineStart);
+        _lineno += cNewlines;
+        _ofs += ofsLineStart;
+
+        // In streaming mode, go on with the next chunk if there was nothing in this one.
+        if (    (ofsFound != string_view::npos)
+             || (!refill())
+           )
+            break;
+    }
+}
+
+/**
+ *  Returns the line at _ofs without moving on. In streaming mode, this reads more of the
+ *  file as needed, and if the rest of the line does not fit into the buffer, it returns
+ *  what is there with fComplete set to false. Returns false at the end of the file.
+ */
+bool PhpScanner::peekLine(string_view &svLine,
+                          bool &fComplete)
+{
+    fComplete = true;
+    while (1)
+    {
+        size_t ofsNewline = _svFile.find('\n', _ofs);
+        if (ofsNewline != string_view::npos)
+        {
+            svLine = _svFile.substr(_ofs, ofsNewline - _ofs);
+            return true;
+        }
+
+        if (!refill())
+            break;
+    }
+
+    if (_ofs >= _svFile.length())
+        return false;
+
+    // The last line without a newline, or a piece of a long line.
+    svLine = _svFile.substr(_ofs);
+    fComplete = (!_pChunked) || (_pChunked->eof());
+    return true;
+}
+
+/**
+ *  Returns the next line of interest in line. If fWantCode is true, this includes every
+ *  line outside of doc comments that is not blank. Returns false at the end of the file.
+ */
+bool PhpScanner::next(ScannedLine &line,
+                      bool fWantCode)
+{
+    if (_iPending < _cPending)
+    {
+        line = _aPending[_iPending++];
+        return true;
+    }
+
+    string_view svLine;
+    bool fComplete;
+    while (1)
+    {
+        if (!fWantCode)
+            skipQuietLines();
+        if (!peekLine(svLine, fComplete))
+            break;
+
+        bool fLineStart = _fLineStart;
+        if (fLineStart)
+            ++_lineno;
+
+        Context ctxStart = _ctx;
+        size_t ofsDocClose, cbLexed;
+        bool fDocOpen = lexLine(svLine, fComplete, ofsDocClose, cbLexed);
+
+        if (fComplete)
+            _ofs = std::min(_ofs + svLine.length() + 1, _svFile.length());
+        else
+        {
+            _ofs += cbLexed;
+            svLine = svLine.substr(0, cbLexed);
+        }
+        _fLineStart = fComplete;
+
+        if (ctxStart == Context::DOC_COMMENT)
+        {
+            // Return every piece of a long line, so that none of the comment text gets lost.
+            line = { (ofsDocClose == string_view::npos) ? ScannedLine::Type::DOC_LINE
+                                                        : ScannedLine::Type::DOC_CLOSE,
+                     svLine,
+                     _lineno,
+                     !fLineStart };
+            return true;
+        }
+
+        if (fDocOpen)
+        {
+            line = { ScannedLine::Type::DOC_OPEN, svLine, _lineno };
+            _cPending = _iPending = 0;
+
+            if (ofsDocClose != string_view::npos)
+            {
+                // One-line doc comment: the text is between the asterisks.
+                size_t ofsText = svLine.find("/**") + 3;
+                while ((ofsText < ofsDocClose) && (svLine[ofsText] == '*'))
+                    ++ofsText;
+                while ((ofsText < ofsDocClose) && (isspace((unsigned char)svLine[ofsText])))
+                    ++ofsText;
+                size_t ofsEnd = ofsDocClose;
+                while ((ofsEnd > ofsText) && (isspace((unsigned char)svLine[ofsEnd - 1])))
+                    --ofsEnd;
+
+                if (ofsEnd > ofsText)
+                    _aPending[_cPending++] = { ScannedLine::Type::DOC_LINE,
+                                               svLine.substr(ofsText, ofsEnd - ofsText),
+                                               _lineno };
+                _aPending[_cPending++] = { ScannedLine::Type::DOC_CLOSE, svLine, _lineno };
+            }
+            return true;
+        }
+
+        if (    (fWantCode)
+             && (fLineStart)
+             && (!isBlank(svLine))
+           )
+        {
+            if (!fComplete)
+                Debug::Warning(_pChunked->getFilename() + ": line " + to_string(_lineno) + " does not fit into the buffer of " + to_string(_pChunked->capacity()) + " bytes, only its start is parsed");
+            line = { ScannedLine::Type::CODE, svLine, _lineno };
+            return true;
+        }
+    }
+
+    return false;
+}
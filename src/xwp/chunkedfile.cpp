@@ -0,0 +1,133 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#include "xwp/chunkedfile.h"
+#include "xwp/except.h"
+#include "xwp/stringhelp.h"
+#include "xwp/simd.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace XWP
+{
+
+ChunkedFile::ChunkedFile(const string &strFilename,
+                         size_t cbBuffer,
+                         bool fCheckUTF8)
+    : _strFilename(strFilename),
+      _fCheckUTF8(fCheckUTF8)
+{
+    if (-1 == (_fd = open(strFilename.c_str(), O_RDONLY | O_CLOEXEC)))
+        throw FSException("Cannot open file " + quote(strFilename) + ": " + strerror(errno));
+
+    posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    _strBuffer.resize(cbBuffer);
+}
+
+ChunkedFile::~ChunkedFile()
+{
+    close(_fd);
+}
+
+/**
+ *  Drops the first cb bytes of view().
+ */
+void ChunkedFile::consume(size_t cb)
+{
+    if (cb > _cbData)
+        cb = _cbData;
+    _ofsData += cb;
+    _cbData -= cb;
+    _ofsInFile += cb;
+    _cbChecked -= std::min(cb, _cbChecked);
+}
+
+/**
+ *  Moves the unconsumed data to the front of the buffer and reads as much of the file
+ *  as fits behind it. Returns the number of bytes read, which is 0 at the end of the
+ *  file or if the buffer is full of unconsumed data.
+ */
+size_t ChunkedFile::read()
+{
+    if (_ofsData)
+    {
+        memmove(&_strBuffer[0], &_strBuffer[_ofsData], _cbData);
+        _ofsData = 0;
+    }
+
+    size_t cbRead = 0;
+    while (    (!_fEOF)
+            && (_cbData < _strBuffer.size())
+          )
+    {
+        ssize_t r = ::read(_fd, &_strBuffer[_cbData], _strBuffer.size() - _cbData);
+        if (r == 0)
+            _fEOF = true;
+        else if (r < 0)
+        {
+            if (errno != EINTR)
+                throw FSException("Cannot read file " + quote(_strFilename) + ": " + strerror(errno));
+        }
+        else
+        {
+            _cbData += r;
+            cbRead += r;
+        }
+    }
+
+    if (_fCheckUTF8)
+        checkUTF8();
+
+    return cbRead;
+}
+
+/**
+ *  Checks the data that has not been checked yet, except for a sequence at the end that
+ *  could continue in the next read(). At the first invalid byte, the rest of the data is
+ *  dropped and the end of the file is pretended.
+ */
+void ChunkedFile::checkUTF8()
+{
+    const char *p = _strBuffer.data() + _ofsData;
+    size_t cbCheck = _cbData;
+    if (!_fEOF)
+        // Leave out a lead byte and up to two continuation bytes at the end.
+        for (size_t n = 1;
+             (n <= 3) && (n <= cbCheck);
+             ++n)
+        {
+            unsigned char c = p[cbCheck - n];
+            if ((c & 0xC0) == 0x80)
+                continue;
+            if (c >= 0xC0)
+                cbCheck -= n;
+            break;
+        }
+
+    if (cbCheck <= _cbChecked)
+        return;
+
+    size_t ofs = findInvalidUTF8(string_view(p + _cbChecked, cbCheck - _cbChecked));
+    if (ofs == string_view::npos)
+        _cbChecked = cbCheck;
+    else
+    {
+        _cbChecked += ofs;
+        _cbData = _cbChecked;
+        _ofsInvalidUTF8 = _ofsInFile + _cbChecked;
+        _fEOF = true;
+    }
+}
+
+} // namespace XWP
@@ -46,10 +46,14 @@ public:
     { }
 };
 
-list<FuncItem> g_llFuncs2;
-uint g_iIndent2 = 0;
+// Function stack and indentation are per thread so that Enter/Leave pairs from different threads don't mix.
+thread_local list<FuncItem> g_llFuncs2;
+thread_local uint g_iIndent2 = 0;
 bool g_fNeedsNewline2 = false;
 
+// If set, Log() output on this thread goes here instead of to stdout. See DebugCapture.
+thread_local string *g_pstrCapture = NULL;
+
 /* static */
 void Debug::Enter(DebugFlag fl,
                   const string &strFuncName,
@@ -100,26 +104,36 @@ void Debug::Log(DebugFlag fl,
          || (g_flDebugSet & (uint)fl)
        )
     {
+        string strOut;
         if (g_fNeedsNewline2)
         {
             if (0 == (flMessage & CONTINUE_FROM_PREVIOUS))
-                cout << "\n";
+                strOut += "\n";
             g_fNeedsNewline2 = false;
         }
 
-        string strIndent;
         if (fAlways && (g_iIndent2 > 0))
-            cout << g_strDebugProgramName << MakeColor(AnsiColor::BRIGHT_WHITE, ">") << string(g_iIndent2 * 2 - 1, ' ');
+            strOut += g_strDebugProgramName + MakeColor(AnsiColor::BRIGHT_WHITE, ">") + string(g_iIndent2 * 2 - 1, ' ');
         else
-            cout << g_strDebugProgramName << string(g_iIndent2 * 2, ' ');
-        cout << str;
+            strOut += g_strDebugProgramName + string(g_iIndent2 * 2, ' ');
+        strOut += str;
+        bool fFlush = false;
         if ( (!fAlways) || (0 == (flMessage & NO_ECHO_NEWLINE)) )
-            cout << "\n";
+            strOut += "\n";
         else
         {
-            cout.flush();
+            fFlush = true;
             g_fNeedsNewline2 = true;     // for next message
         }
+
+        if (g_pstrCapture)
+            *g_pstrCapture += strOut;
+        else
+        {
+            cout << strOut;
+            if (fFlush)
+                cout.flush();
+        }
     }
 }
 
@@ -202,6 +216,24 @@ Debug::Warning(const string& str)
     Log(DEBUG_ALWAYS, MakeColor(AnsiColor::YELLOW, "WARNING: " + str));
 }
 
+
+/***************************************************************************
+ *
+ *  DebugCapture
+ *
+ **************************************************************************/
+
+DebugCapture::DebugCapture(string &strTarget)
+    : _pstrPrevious(g_pstrCapture)
+{
+    g_pstrCapture = &strTarget;
+}
+
+DebugCapture::~DebugCapture()
+{
+    g_pstrCapture = _pstrPrevious;
+}
+
 } // namespace
 
 void DebugEnter(const char *pcszFormat, ...)
@@ -0,0 +1,339 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#include "xwp/dirwalk.h"
+#include "xwp/thread.h"
+#include "xwp/debug.h"
+#include "xwp/stringhelp.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace XWP
+{
+
+struct FileID
+{
+    dev_t   dev;
+    ino_t   ino;
+
+    bool operator==(const FileID &id) const
+    {
+        return (dev == id.dev) && (ino == id.ino);
+    }
+
+    bool operator<(const FileID &id) const
+    {
+        return (dev < id.dev) || ((dev == id.dev) && (ino < id.ino));
+    }
+};
+
+struct DirItem
+{
+    string          strPath;
+    vector<FileID>  vAncestors;         // Directories above this one, for loop detection.
+    bool            fViaSymlink;
+    size_t          cchRoot;            // Length of the root directory prefix of strPath, with its slash.
+};
+
+struct FoundFile
+{
+    string          strPath;
+    FileID          id;
+    bool            fViaSymlink;
+};
+
+struct FileFinder::Impl
+{
+    StringVector            vIncludes;
+    StringVector            vExcludes;
+    unsigned int            cThreads = 0;
+
+    // Everything below is protected by the mutex.
+    std::mutex              m;
+    std::condition_variable cv;
+    std::deque<DirItem>     qDirs;
+    uint                    cBusy = 0;  // Workers that are currently reading a directory.
+    vector<FoundFile>       vFound;
+    StringVector            vErrors;
+
+    bool isIncluded(const char *pcszName) const;
+    bool isExcluded(const char *pcszRelPath, const char *pcszName) const;
+
+    void readDir(DirItem &dir,
+                 vector<DirItem> &vSubdirs,
+                 vector<FoundFile> &vFoundHere,
+                 StringVector &vErrorsHere);
+
+    void worker();
+};
+
+bool FileFinder::Impl::isIncluded(const char *pcszName) const
+{
+    for (const auto &strGlob : vIncludes)
+        if (0 == fnmatch(strGlob.c_str(), pcszName, 0))
+            return true;
+
+    return false;
+}
+
+/**
+ *  Returns true if the given file or directory matches one of the exclude globs. A glob
+ *  without a slash is matched against the name only, one with a slash against the path
+ *  relative to the root directory that is being walked, so that "htdocs/3rdparty" excludes
+ *  src/htdocs/3rdparty when walking src.
+ */
+bool FileFinder::Impl::isExcluded(const char *pcszRelPath,
+                                  const char *pcszName) const
+{
+    for (const auto &strGlob : vExcludes)
+    {
+        if (strGlob.find('/') == string::npos)
+        {
+            if (0 == fnmatch(strGlob.c_str(), pcszName, 0))
+                return true;
+        }
+        else if (0 == fnmatch(strGlob.c_str(), pcszRelPath, 0))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ *  Reads one directory. Called on a worker thread without the mutex held; results
+ *  go into the given thread-private lists.
+ */
+void FileFinder::Impl::readDir(DirItem &dir,
+                               vector<DirItem> &vSubdirs,
+                               vector<FoundFile> &vFoundHere,
+                               StringVector &vErrorsHere)
+{
+    DIR *pDir;
+    if (!(pDir = opendir(dir.strPath.c_str())))
+    {
+        vErrorsHere.push_back("cannot read directory " + quote(dir.strPath) + ": " + strerror(errno));
+        return;
+    }
+
+    int fdDir = dirfd(pDir);
+    struct stat st;
+    if (fstat(fdDir, &st))
+    {
+        // Without the device and inode we can neither detect loops nor de-duplicate files.
+        vErrorsHere.push_back("cannot stat directory " + quote(dir.strPath) + ": " + strerror(errno));
+        closedir(pDir);
+        return;
+    }
+
+    FileID idDir { st.st_dev, st.st_ino };
+    if (std::find(dir.vAncestors.begin(), dir.vAncestors.end(), idDir) != dir.vAncestors.end())
+    {
+        vErrorsHere.push_back("file system loop detected at " + quote(dir.strPath) + ", not descending");
+        closedir(pDir);
+        return;
+    }
+    dir.vAncestors.push_back(idDir);
+    dev_t devDir = st.st_dev;
+
+    struct dirent *pEntry;
+    while ((pEntry = readdir(pDir)))
+    {
+        const char *pcszName = pEntry->d_name;
+        if (    (pcszName[0] == '.')
+             && (    (!pcszName[1])
+                  || ((pcszName[1] == '.') && (!pcszName[2]))
+                )
+           )
+            continue;
+
+        unsigned char type = pEntry->d_type;
+        FileID id { devDir, pEntry->d_ino };
+        bool fSymlink = false;
+
+        if (    (type == DT_LNK)
+             || (type == DT_UNKNOWN)
+           )
+        {
+            // Only here do we need to stat. Follow symlinks like find -L.
+            struct stat st2;
+            if (type == DT_UNKNOWN)
+            {
+                if (fstatat(fdDir, pcszName, &st2, AT_SYMLINK_NOFOLLOW))
+                    continue;
+                fSymlink = S_ISLNK(st2.st_mode);
+            }
+            else
+                fSymlink = true;
+
+            if (fstatat(fdDir, pcszName, &st2, 0))
+                continue;       // Dangling symlink.
+
+            type =   S_ISDIR(st2.st_mode) ? DT_DIR
+                   : S_ISREG(st2.st_mode) ? DT_REG
+                   : DT_UNKNOWN;
+            id = { st2.st_dev, st2.st_ino };
+        }
+
+        if (type == DT_DIR)
+        {
+            string strPath = makePath(dir.strPath, pcszName);
+            if (!isExcluded(strPath.c_str() + dir.cchRoot, pcszName))
+                vSubdirs.push_back( { strPath,
+                                      dir.vAncestors,
+                                      dir.fViaSymlink || fSymlink,
+                                      dir.cchRoot } );
+        }
+        else if (type == DT_REG)
+        {
+            if (isIncluded(pcszName))
+            {
+                string strPath = makePath(dir.strPath, pcszName);
+                if (!isExcluded(strPath.c_str() + dir.cchRoot, pcszName))
+                    vFoundHere.push_back( { strPath,
+                                            id,
+                                            dir.fViaSymlink || fSymlink } );
+            }
+        }
+    }
+
+    closedir(pDir);
+}
+
+/**
+ *  Thread function. Keeps taking directories off the queue until the queue is
+ *  empty and no other worker is still reading a directory that might add more.
+ */
+void FileFinder::Impl::worker()
+{
+    vector<DirItem> vSubdirs;
+    vector<FoundFile> vFoundHere;
+    StringVector vErrorsHere;
+
+    std::unique_lock<std::mutex> lock(m);
+    while (1)
+    {
+        cv.wait(lock, [this]() { return (!qDirs.empty()) || (!cBusy); });
+        if (qDirs.empty())
+            break;
+
+        DirItem dir = std::move(qDirs.front());
+        qDirs.pop_front();
+        ++cBusy;
+
+        lock.unlock();
+        readDir(dir, vSubdirs, vFoundHere, vErrorsHere);
+        lock.lock();
+
+        --cBusy;
+        for (auto &d : vSubdirs)
+            qDirs.push_back(std::move(d));
+        vSubdirs.clear();
+        cv.notify_all();
+    }
+
+    appendVector(vErrors, vErrorsHere);
+    vFound.insert(vFound.end(), vFoundHere.begin(), vFoundHere.end());
+}
+
+FileFinder::FileFinder()
+    : _pImpl(new Impl)
+{ }
+
+FileFinder::~FileFinder()
+{
+    delete _pImpl;
+}
+
+void FileFinder::addInclude(const string &strGlob)
+{
+    _pImpl->vIncludes.push_back(strGlob);
+}
+
+void FileFinder::addExclude(const string &strGlob)
+{
+    _pImpl->vExcludes.push_back(strGlob);
+}
+
+/**
+ *  Sets the number of threads for run(). With 0 (the default), one thread per CPU is used.
+ */
+void FileFinder::setThreads(unsigned int cThreads)
+{
+    _pImpl->cThreads = cThreads;
+}
+
+/**
+ *  Walks the given directories and appends all matching files to vFiles, sorted
+ *  by path so that the result does not depend on thread scheduling. Problems like
+ *  unreadable directories are reported as warnings.
+ */
+void FileFinder::run(const StringVector &vRoots,
+                     StringVector &vFiles)
+{
+    for (const auto &strRoot : vRoots)
+        _pImpl->qDirs.push_back( { strRoot, {}, false, makePath(strRoot, "").length() } );
+
+    unsigned int cThreads = _pImpl->cThreads;
+    if (!cThreads)
+        cThreads = Thread::getHardwareConcurrency();
+    if (!cThreads)
+        cThreads = 1;
+
+    vector<std::thread> vThreads;
+    for (unsigned int u = 0;
+         u < cThreads;
+         ++u)
+        vThreads.push_back(std::thread([this]() { _pImpl->worker(); }));
+    for (auto &t : vThreads)
+        t.join();
+
+    sort(_pImpl->vErrors.begin(), _pImpl->vErrors.end());
+    for (const auto &strError : _pImpl->vErrors)
+        Debug::Warning(strError);
+
+    // Report files that are reachable under several names only once.
+    auto &vFound = _pImpl->vFound;
+    sort(vFound.begin(),
+         vFound.end(),
+         [](const FoundFile &f1, const FoundFile &f2)
+         {
+             if (!(f1.id == f2.id))
+                 return f1.id < f2.id;
+             if (f1.fViaSymlink != f2.fViaSymlink)
+                 return !f1.fViaSymlink;
+             return f1.strPath < f2.strPath;
+         });
+
+    StringVector v;
+    for (size_t u = 0;
+         u < vFound.size();
+         ++u)
+        if ((!u) || (!(vFound[u].id == vFound[u - 1].id)))
+            v.push_back(vFound[u].strPath);
+
+    sort(v.begin(), v.end());
+    appendVector(vFiles, v);
+
+    vFound.clear();
+    _pImpl->vErrors.clear();
+}
+
+} // namespace XWP
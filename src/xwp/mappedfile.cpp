@@ -0,0 +1,111 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#include "xwp/mappedfile.h"
+#include "xwp/except.h"
+#include "xwp/stringhelp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace XWP
+{
+
+// Files smaller than this are read instead of mapped.
+const size_t MMAP_THRESHOLD = 256 * 1024;
+
+MappedFile::MappedFile(const string &strFilename)
+{
+    int fd;
+    if (-1 == (fd = open(strFilename.c_str(), O_RDONLY | O_CLOEXEC)))
+        throw FSException("Cannot open file " + quote(strFilename) + ": " + strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st))
+    {
+        int e = errno;
+        close(fd);
+        throw FSException("Cannot stat file " + quote(strFilename) + ": " + strerror(e));
+    }
+
+    size_t cb = st.st_size;
+    if (    (S_ISREG(st.st_mode))
+         && (cb >= MMAP_THRESHOLD)
+       )
+    {
+        void *p = mmap(NULL, cb, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            madvise(p, cb, MADV_SEQUENTIAL);
+            _p = (const char*)p;
+            _cb = cb;
+            _fMapped = true;
+        }
+    }
+
+    if (!_fMapped)
+    {
+        // One byte more than the size so that the read() which reports EOF needs no resize.
+        size_t cbRead = 0;
+        _strBuffer.resize(cb + 1);
+        while (1)
+        {
+            if (cbRead == _strBuffer.size())
+                _strBuffer.resize(_strBuffer.size() * 2);
+
+            ssize_t r = read(fd, &_strBuffer[cbRead], _strBuffer.size() - cbRead);
+            if (r == 0)
+                break;
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                int e = errno;
+                close(fd);
+                throw FSException("Cannot read file " + quote(strFilename) + ": " + strerror(e));
+            }
+            cbRead += r;
+        }
+        _strBuffer.resize(cbRead);
+
+        _p = _strBuffer.data();
+        _cb = cbRead;
+    }
+
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (_fMapped)
+        munmap((void*)_p, _cb);
+}
+
+/**
+ *  Replaces the contents with str, e.g. with a transcoded copy of them.
+ */
+void MappedFile::assign(string &&str)
+{
+    if (_fMapped)
+    {
+        munmap((void*)_p, _cb);
+        _fMapped = false;
+    }
+
+    _strBuffer = std::move(str);
+    _p = _strBuffer.data();
+    _cb = _strBuffer.size();
+}
+
+} // namespace XWP
@@ -12,74 +12,521 @@
 #include "xwp/except.h"
 #include "xwp/debug.h"
 #include "xwp/stringhelp.h"
+#include "xwp/simd.h"
 
-#include "pcre.h"
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include "pcre2.h"
 
-#include <fstream>
+#include <algorithm>
 
-const string& RegexMatches::get(uint u)
+#ifdef XWP_REGEX_STATS
+#include "xwp/thread.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <iostream>
+#endif
+
+/**
+ *  Called by Regex::matches() after a successful match to start over with the given haystack
+ *  and cCaptures pairs of offsets, which the caller then fills in.
+ */
+void RegexMatches::reset(string_view svHaystack,
+                         size_t cCaptures)
+{
+    _svHaystack = svHaystack;
+    _vOffsets.resize(cCaptures * 2);
+    // Keep the strings themselves so that their buffers get reused by the next get() calls.
+    if (_vStrings.size() < cCaptures)
+        _vStrings.resize(cCaptures);
+    _vfCopied.assign(cCaptures, false);
+}
+
+/**
+ *  Returns the given capture as a view into the haystack. As with get(), 0 is the entire
+ *  match and 1 the first capture. An unset capture is returned as an empty string_view.
+ *
+ *  Throws if u is out of range.
+ */
+string_view RegexMatches::view(uint u) const
 {
     string strExcept;
-    if (v.empty())
+    if (_vOffsets.empty())
         strExcept = "Invalid index " + to_string(u) + " into EMPTY regex matches";
     else
     {
-        if (u < v.size())
-            return v[u];
+        if (u < _vOffsets.size() / 2)
+        {
+            size_t first = _vOffsets[u * 2];
+            size_t last = _vOffsets[u * 2 + 1];
+            if (first < _svHaystack.length())
+                return _svHaystack.substr(first, last - first);
+            return string_view();
+        }
 
-        strExcept = "Invalid index " + to_string(u) + " into regex matches (0: " + quote(v[0]) + ")";
+        strExcept = "Invalid index " + to_string(u) + " into regex matches (0: " + quote(string(view(0))) + ")";
     }
 
     if (pRE)
-        strExcept += " -- size was " + to_string(v.size()) + " -- RE: " + quote(pRE->toString()) + "";
+        strExcept += " -- size was " + to_string(_vOffsets.size() / 2) + " -- RE: " + quote(pRE->toString()) + "";
     throw FSException(strExcept);
 }
 
+/**
+ *  Like view(), but returns a copy of the capture, which remains valid until the next
+ *  successful match with this RegexMatches. Use view() instead if a string_view will do.
+ */
+const string& RegexMatches::get(uint u)
+{
+    string_view sv = view(u);
+    if (!_vfCopied[u])
+    {
+        _vStrings[u].assign(sv);
+        _vfCopied[u] = true;
+    }
+
+    return _vStrings[u];
+}
+
+/**
+ *  Splits str into literal pieces and backreferences.
+ */
+RegexReplacement::RegexReplacement(const string &str)
+    : _str(str)
+{
+    size_t ofsLiteral = 0;
+    size_t ofs = 0;
+    while ((ofs = _str.find('$', ofs)) != string::npos)
+    {
+        if (    (ofs + 1 < _str.length())
+             && (_str[ofs + 1] >= '1')
+             && (_str[ofs + 1] <= '9')
+           )
+        {
+            if (ofs > ofsLiteral)
+                _vPieces.push_back( { ofsLiteral, ofs - ofsLiteral, -1 } );
+            int iCapture = _str[ofs + 1] - '0';
+            _vPieces.push_back( { 0, 0, iCapture } );
+            if (iCapture > _maxCapture)
+                _maxCapture = iCapture;
+            ofs += 2;
+            ofsLiteral = ofs;
+        }
+        else
+            ++ofs;
+    }
+
+    if (ofsLiteral < _str.length())
+        _vPieces.push_back( { ofsLiteral, _str.length() - ofsLiteral, -1 } );
+}
+
+/**
+ *  Appends the replacement to strOut, taking the backreferences from aMatches.
+ */
+void RegexReplacement::appendTo(string &strOut,
+                                const RegexMatches &aMatches) const
+{
+    for (const auto &piece : _vPieces)
+        if (piece.iCapture < 0)
+            strOut.append(_str, piece.ofs, piece.len);
+        else if ((size_t)piece.iCapture <= aMatches.size())
+            strOut.append(aMatches.view(piece.iCapture));
+}
+
+/**
+ *  Match data and JIT stack for one thread.
+ *
+ *  PCRE2 wants a match data block for every match, and the JIT code a stack that is larger
+ *  than the 32 KB it uses by default if none is assigned. Allocating those for every call to
+ *  matches() would cost more than many of the matches themselves, and sharing them between
+ *  threads is not allowed, so every thread that uses a regex gets its own set once, which is
+ *  then used for all regexen. The set is freed when the thread exits.
+ */
+struct RegexThreadData
+{
+    pcre2_match_data    *pMatchData = NULL;
+    uint32_t            cPairs = 0;
+    pcre2_jit_stack     *pJITStack = NULL;
+    pcre2_match_context *pMatchContext = NULL;
+    PCRE2_SIZE          aLiteralMatch[2];   // Offsets of a match found without PCRE, see Regex::Impl::match().
+
+    ~RegexThreadData()
+    {
+        if (pMatchData)
+            pcre2_match_data_free(pMatchData);
+        if (pMatchContext)
+            pcre2_match_context_free(pMatchContext);
+        if (pJITStack)
+            pcre2_jit_stack_free(pJITStack);
+    }
+
+    /**
+     *  Returns the thread's match data, after making sure it has room for at least cPairs
+     *  offset pairs.
+     */
+    pcre2_match_data* getMatchData(uint32_t cPairs0)
+    {
+        if (cPairs0 > cPairs)
+        {
+            if (pMatchData)
+                pcre2_match_data_free(pMatchData);
+            // Start with 16 pairs, which is enough for every regex that phoxygen has.
+            cPairs = std::max(cPairs0, (uint32_t)16);
+            if (!(pMatchData = pcre2_match_data_create(cPairs, NULL)))
+                throw FSException("Out of memory allocating regex match data");
+        }
+
+        return pMatchData;
+    }
+
+    /**
+     *  Returns the match context with the thread's JIT stack.
+     */
+    pcre2_match_context* getMatchContext()
+    {
+        if (!pMatchContext)
+        {
+            if (    (!(pMatchContext = pcre2_match_context_create(NULL)))
+                 || (!(pJITStack = pcre2_jit_stack_create(32 * 1024, 512 * 1024, NULL)))
+               )
+                throw FSException("Out of memory allocating regex JIT stack");
+            pcre2_jit_stack_assign(pMatchContext, NULL, pJITStack);
+        }
+
+        return pMatchContext;
+    }
+};
+
+thread_local RegexThreadData g_regexThreadData;
+
+/**
+ *  Looks at a regex pattern for the fast paths in Regex::Impl. Returns the literal text that
+ *  every match of the pattern must start with, which is empty if there is none. fAnchored
+ *  receives whether the pattern starts with ^, and fLiteral whether the pattern is nothing
+ *  but that text.
+ *
+ *  This only understands a small part of the syntax: escaped punctuation counts as literal,
+ *  anything else with a backslash or any other metacharacter ends the text. A character
+ *  followed by a quantifier is not part of it, and a top-level alternation means that there
+ *  is no required text at all.
+ */
+static string analyzePattern(const string &strPattern,
+                             bool &fAnchored,
+                             bool &fLiteral)
+{
+    static const string strMeta("\\^$.|?*+()[]{}");
+    string strText;
+    size_t len = strPattern.length();
+    size_t i = 0;
+    fAnchored = (len && strPattern[0] == '^');
+    if (fAnchored)
+        ++i;
+
+    while (i < len)
+    {
+        unsigned char c = strPattern[i];
+        size_t cbAtom = 1;
+        if (c == '\\')
+        {
+            if (    (i + 1 >= len)
+                 || ((unsigned char)strPattern[i + 1] >= 0x80)
+                 || (isalnum((unsigned char)strPattern[i + 1]))
+               )
+                break;
+            cbAtom = 2;
+        }
+        else if (strMeta.find(c) != string::npos)
+            break;
+        else if (c >= 0x80)
+            // A quantifier after a multibyte character applies to all of it.
+            while (    (i + cbAtom < len)
+                    && (((unsigned char)strPattern[i + cbAtom] & 0xC0) == 0x80)
+                  )
+                ++cbAtom;
+
+        if (i + cbAtom < len)
+        {
+            char cNext = strPattern[i + cbAtom];
+            if (    (cNext == '?')
+                 || (cNext == '*')
+                 || (cNext == '+')
+                 || (cNext == '{')
+               )
+                break;
+        }
+
+        if (c == '\\')
+            strText += strPattern[i + 1];
+        else
+            strText.append(strPattern, i, cbAtom);
+        i += cbAtom;
+    }
+
+    fLiteral = (i == len);
+
+    // Look for a top-level alternation in the rest of the pattern.
+    int iDepth = 0;
+    bool fInClass = false;
+    for (;
+         i < len;
+         ++i)
+    {
+        char c = strPattern[i];
+        if (c == '\\')
+            ++i;
+        else if (fInClass)
+        {
+            if (c == ']')
+                fInClass = false;
+        }
+        else if (c == '[')
+        {
+            fInClass = true;
+            // A ] right after [ or [^ is a literal one.
+            if ((i + 1 < len) && (strPattern[i + 1] == '^'))
+                ++i;
+            if ((i + 1 < len) && (strPattern[i + 1] == ']'))
+                ++i;
+        }
+        else if (c == '(')
+            ++iDepth;
+        else if (c == ')')
+            --iDepth;
+        else if ((c == '|') && (iDepth == 0))
+            return "";
+    }
+
+    return strText;
+}
+
+#ifdef XWP_REGEX_STATS
+
+/**
+ *  Counters for one compiled regex; see Regex::EnableStats(). These are updated from all
+ *  threads that use the regex, hence the atomics.
+ */
+struct RegexStats
+{
+    std::atomic<uint64_t>   cCalls {0};
+    std::atomic<uint64_t>   cMatches {0};
+    std::atomic<uint64_t>   cbScanned {0};
+    std::atomic<uint64_t>   nsTime {0};
+};
+
+/**
+ *  All regexen that currently exist, plus the totals of those that have been destroyed
+ *  already, by pattern.
+ */
+struct RegexStatsRegistry
+{
+    struct Totals
+    {
+        uint64_t    cCalls = 0;
+        uint64_t    cMatches = 0;
+        uint64_t    cbScanned = 0;
+        uint64_t    nsTime = 0;
+
+        void add(const RegexStats &stats)
+        {
+            cCalls += stats.cCalls;
+            cMatches += stats.cMatches;
+            cbScanned += stats.cbScanned;
+            nsTime += stats.nsTime;
+        }
+    };
+
+    XWP::Mutex                              mutex;
+    map<const RegexStats*, const string*>   mapLive;        // Counters and pattern of every existing regex.
+    map<string, Totals>                     mapRetired;
+};
+
+bool g_fRegexStats = false;
+
+/**
+ *  Allocated on first use and never freed, since regexen in global objects can be destroyed
+ *  after any static registry would have been.
+ */
+static RegexStatsRegistry& GetRegexStatsRegistry()
+{
+    static RegexStatsRegistry *pRegistry = new RegexStatsRegistry;
+    return *pRegistry;
+}
+
+#endif // XWP_REGEX_STATS
+
 /**
  *  Private class to keep the junk out of the header.
  */
 class Regex::Impl
 {
 public:
-    pcre        *_pRE = NULL;
-    pcre_extra  *_pPCREExtra = NULL;
+    pcre2_code  *_pRE = NULL;
+    uint32_t    _cPairs = 1;            // Number of captures plus one for the whole match.
+    bool        _fJIT = false;
     string      _str;
 
+    // Fast paths, see analyzePattern().
+    string      _strPrefix;             // Literal text that every match starts with.
+    bool        _fAnchored = false;     // Pattern starts with ^, so matches can only be at offset 0.
+    bool        _fLiteral = false;      // Pattern is just _strPrefix (and not anchored), so PCRE is not needed.
+
+#ifdef XWP_REGEX_STATS
+    mutable RegexStats  _stats;
+#endif
+
     Impl(const string &str)
         : _str(str)
     {
-        const char *pcszError = NULL;
-        int iOffset = 0;
-        if (!(_pRE = pcre_compile(str.c_str(),
-                                  PCRE_UTF8 | PCRE_NO_UTF8_CHECK, // options   -- PCRE_CASELESS? PCRE_UCP PCRE_UNGREEDY
-                                  &pcszError,
-                                  &iOffset,
-                                  NULL)))      // default character tables
-            throw FSException("Error compiling regular expression " + quote(str) + ": " + string(pcszError));
-
-        _pPCREExtra = pcre_study(_pRE,
-                                 PCRE_STUDY_JIT_COMPILE,        // This option brings search/replace in phoxygen from six seconds down to one.
-                                 &pcszError);
+        int iError = 0;
+        PCRE2_SIZE ofsError = 0;
+        if (!(_pRE = pcre2_compile((PCRE2_SPTR)str.c_str(),
+                                   str.length(),
+                                   PCRE2_UTF | PCRE2_NO_UTF_CHECK, // options   -- PCRE2_CASELESS? PCRE2_UCP PCRE2_UNGREEDY
+                                   &iError,
+                                   &ofsError,
+                                   NULL)))      // default compile context
+        {
+            PCRE2_UCHAR szError[256];
+            pcre2_get_error_message(iError, szError, sizeof(szError));
+            throw FSException("Error compiling regular expression " + quote(str) + " at offset " + to_string(ofsError) + ": " + string((const char*)szError));
+        }
+
+        uint32_t cCaptures = 0;
+        pcre2_pattern_info(_pRE, PCRE2_INFO_CAPTURECOUNT, &cCaptures);
+        _cPairs = cCaptures + 1;
+
+        // JIT brings search/replace in phoxygen from six seconds down to one. If it is not
+        // available on this platform, we fall back to the interpreter.
+        _fJIT = (pcre2_jit_compile(_pRE, PCRE2_JIT_COMPLETE) == 0);
+
+        bool fAnchored, fLiteral;
+        _strPrefix = analyzePattern(str, fAnchored, fLiteral);
+        if (!_strPrefix.empty())
+        {
+            _fAnchored = fAnchored;
+            _fLiteral = fLiteral && !fAnchored;
+        }
+
+#ifdef XWP_REGEX_STATS
+        RegexStatsRegistry &reg = GetRegexStatsRegistry();
+        XWP::Lock lock(reg.mutex);
+        reg.mapLive[&_stats] = &_str;
+#endif
     }
 
     ~Impl()
     {
+#ifdef XWP_REGEX_STATS
+        RegexStatsRegistry &reg = GetRegexStatsRegistry();
+        XWP::Lock lock(reg.mutex);
+        reg.mapLive.erase(&_stats);
+        if (_stats.cCalls)
+            reg.mapRetired[_str].add(_stats);
+#endif
         if (_pRE)
         {
-            pcre_free(_pRE);
+            pcre2_code_free(_pRE);
             _pRE = NULL;
         }
-        if (_pPCREExtra)
+    }
+
+    /**
+     *  Runs the regex on the given subject, starting at ofs, with the calling thread's match
+     *  data. Returns what pcre2_match() returns, that is, one more than the highest pair of
+     *  offsets that was set, or a negative error code. The offsets are then in *ppOVector,
+     *  which stays valid until the next match on the same thread.
+     *
+     *  If the pattern is plain text, this uses findString() instead of PCRE. If it starts
+     *  with some text, that is looked for first, and PCRE only runs if it is there.
+     *
+     *  The subject must be valid UTF-8; the loaders in main.cpp make sure of that, so the
+     *  check is skipped here.
+     */
+    int match(string_view svHaystack,
+              size_t ofs,
+              PCRE2_SIZE **ppOVector) const
+    {
+#ifdef XWP_REGEX_STATS
+        if (g_fRegexStats)
         {
-            pcre_free(_pPCREExtra);
-            _pPCREExtra = NULL;
+            auto t1 = chrono::steady_clock::now();
+            int rc = matchImpl(svHaystack, ofs, ppOVector);
+            auto t2 = chrono::steady_clock::now();
+            _stats.cCalls.fetch_add(1, std::memory_order_relaxed);
+            if (rc > 0)
+                _stats.cMatches.fetch_add(1, std::memory_order_relaxed);
+            if (ofs < svHaystack.length())
+                _stats.cbScanned.fetch_add(svHaystack.length() - ofs, std::memory_order_relaxed);
+            _stats.nsTime.fetch_add(chrono::duration_cast<chrono::nanoseconds>(t2 - t1).count(), std::memory_order_relaxed);
+            return rc;
         }
+#endif
+        return matchImpl(svHaystack, ofs, ppOVector);
     }
 
+    int matchImpl(string_view svHaystack,
+                  size_t ofs,
+                  PCRE2_SIZE **ppOVector) const
+    {
+        RegexThreadData &td = g_regexThreadData;
+
+        if (!_strPrefix.empty())
+        {
+            if (ofs > svHaystack.length())
+                return PCRE2_ERROR_NOMATCH;
+
+            if (_fAnchored)
+            {
+                // Without PCRE2_MULTILINE, ^ only matches at the start of the subject.
+                if (    (ofs != 0)
+                     || (svHaystack.substr(0, _strPrefix.length()) != _strPrefix)
+                   )
+                    return PCRE2_ERROR_NOMATCH;
+            }
+            else
+            {
+                size_t ofsFound = XWP::findString(svHaystack.substr(ofs), _strPrefix);
+                if (ofsFound == string_view::npos)
+                    return PCRE2_ERROR_NOMATCH;
+                ofs += ofsFound;
+
+                if (_fLiteral)
+                {
+                    td.aLiteralMatch[0] = ofs;
+                    td.aLiteralMatch[1] = ofs + _strPrefix.length();
+                    *ppOVector = td.aLiteralMatch;
+                    return 1;
+                }
+                // Otherwise run PCRE from where the prefix is, since no match can start before.
+            }
+        }
+
+        pcre2_match_data *pMatchData = td.getMatchData(_cPairs);
+        int rc;
+        if (_fJIT)
+            rc = pcre2_jit_match(_pRE,
+                                 (PCRE2_SPTR)svHaystack.data(),
+                                 svHaystack.length(),
+                                 ofs,
+                                 PCRE2_NO_UTF_CHECK,
+                                 pMatchData,
+                                 td.getMatchContext());
+        else
+            rc = pcre2_match(_pRE,
+                             (PCRE2_SPTR)svHaystack.data(),
+                             svHaystack.length(),
+                             ofs,
+                             PCRE2_NO_UTF_CHECK,
+                             pMatchData,
+                             NULL);
+        *ppOVector = pcre2_get_ovector_pointer(pMatchData);
+        return rc;
+    }
+
+    template<typename Fn>
     int forEachMatch(const string &strHaystack,
-                     std::function<void (size_t i,
-                                         size_t first,
-                                         size_t last)> fnMatch,
+                     Fn fnMatch,
                      int ofs);
 };
 
@@ -95,37 +542,28 @@ public:
  *  return value as a new offset.
  *
  *  If this returns 0 then nothing was found. A negative number is a PCRE error code.
+ *
+ *  fnMatch is called as fnMatch(size_t i, size_t first, size_t last) and must not run
+ *  regexen itself, since the offsets are read from the thread's match data.
  */
+template<typename Fn>
 int Regex::Impl::forEachMatch(const string &strHaystack,
-                              std::function<void (size_t i,
-                                                  size_t first,
-                                                  size_t last)> fnMatch,
+                              Fn fnMatch,
                               int ofs)
 {
-    size_t cVectors = 30;
-    int ovector[cVectors];
-
-    size_t c = 0;
-    int rc = pcre_exec(_pRE,
-                       _pPCREExtra,
-                       strHaystack.c_str(),
-                       strHaystack.length(),
-                       ofs,              /* start at offset 0 in the subject */
-                       PCRE_NO_UTF8_CHECK,              /* default options */
-                       ovector,        /* vector of integers for substring information */
-                       cVectors);      /* number of elements (NOT size in bytes) */
-    if (rc >= 0)
+    PCRE2_SIZE *pOVector;
+    int rc = match(strHaystack, ofs, &pOVector);
+    if (rc > 0)
     {
         for (int i = 0;
              i < rc;
              ++i)
         {
-            size_t first = ovector[i * 2];
-            size_t last = ovector[i * 2 + 1];
+            size_t first = pOVector[i * 2];
+            size_t last = pOVector[i * 2 + 1];
             fnMatch(i, first, last);
 
             ofs = last;
-            ++c;
         }
 
         return ofs;
@@ -147,36 +585,20 @@ Regex::~Regex()
 /* static */
 int Regex::GetMaxCapture(const string &strReplace)
 {
-    static const Regex reCaptures("\\$(\\d)");
-    RegexMatches aMatches;
-    int maxCapture = 0;
-    size_t ofs = 0;
-    while (reCaptures.matches(strReplace, aMatches, ofs))
-    {
-        int id = atoi(aMatches.get(1).c_str());
-        if (id > maxCapture)
-            maxCapture = id;
-    }
-
-    return maxCapture;
+    return RegexReplacement(strReplace).getMaxCapture();
 }
 
 /**
  *  Runs this regex against the given string and returns true if it
  *  matches.
  */
-bool Regex::matches(const string &strHaystack) const
+bool Regex::matches(string_view strHaystack) const
 {
-    int ovector[30];
-    int rc = pcre_exec(_pImpl->_pRE,
-                       _pImpl->_pPCREExtra,
-                       strHaystack.c_str(),
-                       strHaystack.length(),
-                       0,              /* start at offset 0 in the subject */
-                       PCRE_NO_UTF8_CHECK,              /* default options */
-                       ovector,        /* vector of integers for substring information */
-                       30);            /* number of elements (NOT size in bytes) */
-    if (rc >= 0)
+    PCRE2_SIZE *pOVector;
+    int rc = _pImpl->match(strHaystack,
+                           0,              /* start at offset 0 in the subject */
+                           &pOVector);
+    if (rc > 0)
         return true;
 
     return false;
@@ -190,9 +612,12 @@ bool Regex::matches(const string &strHaystack) const
  *  the entire match, where get(1) will return the first substring, (2) the second
  *  and so on.
  *
+ *  aMatches only records offsets into strHaystack, so strHaystack must stay
+ *  around for as long as the captures are used.
+ *
  *  Returns true if something was matched.
  */
-bool Regex::matches(const string &strHaystack,
+bool Regex::matches(string_view strHaystack,
                     RegexMatches &aMatches) const
 {
     size_t ofs = 0;
@@ -206,29 +631,23 @@ bool Regex::matches(const string &strHaystack,
  *
  *  Returns true if something was matched.
  */
-bool Regex::matches(const string &strHaystack,
+bool Regex::matches(string_view strHaystack,
                     RegexMatches &aMatches,
                     size_t &ofs) const
 {
     aMatches.pRE = this;
 
-    size_t cVectors = 30;
-    int ovector[cVectors];
-    int rc = pcre_exec(_pImpl->_pRE,
-                       _pImpl->_pPCREExtra,
-                       strHaystack.c_str(),
-                       strHaystack.length(),
-                       ofs,
-                       PCRE_NO_UTF8_CHECK,              /* default options */
-                       ovector,        /* vector of integers for substring information */
-                       cVectors);      /* number of elements (NOT size in bytes) */
-    if (rc >= 0)
+    PCRE2_SIZE *ovector;
+    int rc = _pImpl->match(strHaystack,
+                           ofs,
+                           &ovector);
+    if (rc > 0)
     {
-        /* The value returned by pcre_exec() is one more than the highest numbered pair that has been set.
+        /* The value returned by pcre2_match() is one more than the highest numbered pair that has been set.
          * For example, if two substrings have been captured, the returned value is 3.
          * If there are no capturing subpatterns, the return value from a successful match is 1,
          * indicating that just the first pair of offsets has been set. */
-        aMatches.v.clear();
+        aMatches.reset(strHaystack, rc);
 
         for (int i = 0;
              i < rc;
@@ -236,10 +655,8 @@ bool Regex::matches(const string &strHaystack,
         {
             size_t first = ovector[i * 2];
             size_t last = ovector[i * 2 + 1];
-            if (first < strHaystack.length())
-                aMatches.v.push_back(string(strHaystack, first, last - first));
-            else
-                aMatches.v.push_back("");
+            aMatches._vOffsets[i * 2] = first;
+            aMatches._vOffsets[i * 2 + 1] = last;
 
             ofs = last;
         }
@@ -250,126 +667,57 @@ bool Regex::matches(const string &strHaystack,
     return false;
 }
 
-size_t Regex::findReplaceImpl(string &strHaystack,
-                              std::function<void (const StringVector &vMatches, string &strReplace)> fnMatch,
-                              bool fGlobal) const
+/**
+ *  Replaces the first or (with fGlobal) all matches of this regex in strHaystack with
+ *  strReplace, which can have $1-like backreferences. Returns the number of replacements.
+ *
+ *  This parses strReplace on every call; see the RegexReplacement variant.
+ */
+size_t Regex::findReplace(string &strHaystack,
+                          const string &strReplace,
+                          bool fGlobal) const
 {
-    // State data for easy access from the lambda below.
-    struct
-    {
-        size_t first0 = 0;      // first offset of 0-index call
-        size_t last0 = 0;       // last offset of 0-index call
-        StringVector vMatches;
-    } state;
-
-    size_t cReplacements = 0;
-    string strNew;
-    size_t lastlast = 0;
-    size_t ofs = 0;
-    while (1)
-    {
-        /*
-         *  Example: in
-         *      FOO.FOO.FOO.REST
-         *      0123456789012345
-         *  replace /FOO/ with BAR.
-         *  On the first call, we get first = 0, last = 3.
-         *  On the second, we get     first = 4, last = 7.
-         */
-
-        int rc = _pImpl->forEachMatch(  strHaystack,
-                                        [&strHaystack, fnMatch, &state](size_t i, size_t first, size_t last)
-                                        {
-                                            if (i == 0)
-                                            {
-                                                state.first0 = first;
-                                                state.last0 = last;
-                                            }
-
-                                            string str(strHaystack.substr(first, last - first));
-                                            state.vMatches.push_back(str);
-
-//                                             Debug::Log(0, "Closure: i=" + to_string(i) + ", first=" + to_string(first) + ", last=" + to_string(last) + " => str=" + quote(str) + "");
-                                        },
-                                        ofs);
-
-        if (rc > 0)
-        {
-            if (cReplacements == 0)
-                // First call:
-                strNew = strHaystack.substr(0, state.first0);
-            else
-                // Subsequent calls:
-                if (state.first0 > lastlast)
-                    strNew += strHaystack.substr(lastlast, state.first0 - lastlast);
-
-            string strReplace;
-            fnMatch(state.vMatches, strReplace);
-
-            int maxCapture = GetMaxCapture(strReplace);
-            if (maxCapture)
-            {
-                // Build a non-const replacement string only if we have backreferences.
-                for (int i = 1;
-                    i <= maxCapture;
-                    ++i)
-                {
-                    stringReplace(strReplace,
-                                  "$" + to_string(i),
-                                  state.vMatches[i]);
-                }
-            }
-
-            strNew += strReplace;
-
-            lastlast = state.last0;
-
-            /* Clear vMatches for the next iteration. Otherwise the lambda above will append to it and
-               backreferences will go bad .*/
-            if (fGlobal)
-                state.vMatches.clear();
-
-            // Search again in the haystack after the whole match.
-            ofs = rc + 1;
-
-            ++cReplacements;
-        }
-        else
-            break;
-        if (!fGlobal)
-            break;
-    }
-
-    if (cReplacements)
-    {
-        if (lastlast)
-            strNew += strHaystack.substr(lastlast);
-
-        strHaystack = strNew;
-    }
-
-    return cReplacements;
+    return findReplace(strHaystack,
+                       RegexReplacement(strReplace),
+                       fGlobal);
 }
 
+/**
+ *  Like the string variant, but with a replacement that has been parsed already.
+ */
 size_t Regex::findReplace(string &strHaystack,
-                          const string &strReplace0,
+                          const RegexReplacement &replacement,
                           bool fGlobal) const
 {
-    return findReplaceImpl( strHaystack,
-                            [&strReplace0](const StringVector &vMatches, string &strReplace)
-                            {
-                                strReplace = strReplace0;
-                            },
-                            fGlobal);
+    return findReplaceImpl(strHaystack,
+                           [&replacement](string &strOut, const RegexMatches &aMatches)
+                           {
+                               replacement.appendTo(strOut, aMatches);
+                           },
+                           fGlobal);
 }
 
+/**
+ *  Older callback variant, which receives copies of the whole match and the captures in
+ *  vMatches. Prefer the template variant in the header, which passes the RegexMatches
+ *  and does not copy anything.
+ */
 size_t Regex::findReplace(string &strHaystack,
                           std::function<void (const StringVector &vMatches, string &strReplace)> fnMatch,
                           bool fGlobal) const
 {
-    return findReplaceImpl(strHaystack,
-                           fnMatch,
-                           fGlobal);
+    StringVector vMatches;
+    return findReplace(strHaystack,
+                       [&fnMatch, &vMatches](const RegexMatches &aMatches, string &strReplace)
+                       {
+                           vMatches.resize(aMatches.size() + 1);
+                           for (uint i = 0;
+                                i < vMatches.size();
+                                ++i)
+                               vMatches[i].assign(aMatches.view(i));
+                           fnMatch(vMatches, strReplace);
+                       },
+                       fGlobal);
 }
 
 /**
@@ -406,15 +754,143 @@ const string& Regex::toString() const
     return _pImpl->_str;
 }
 
-bool Regex::findInFile(const string &strFilename,
-                       RegexMatches &aMatches)
+#ifdef XWP_REGEX_STATS
+
+/**
+ *  Starts counting calls, matches, bytes scanned and time for every regex, which DumpStats()
+ *  prints. This costs two clock reads per match, so it is off unless enabled here.
+ */
+/* static */
+void Regex::EnableStats()
 {
-    ifstream ifs(strFilename);
-    string strLine;
+    g_fRegexStats = true;
+}
 
-    while (getline(ifs, strLine))
-        if (matches(strLine, aMatches))
-            return true;
+/**
+ *  Prints the counters collected since EnableStats() to stdout, one line per pattern, sorted
+ *  by the time spent. Regexen with the same pattern are added up.
+ */
+/* static */
+void Regex::DumpStats()
+{
+    RegexStatsRegistry &reg = GetRegexStatsRegistry();
+    map<string, RegexStatsRegistry::Totals> mapTotals;
+    {
+        XWP::Lock lock(reg.mutex);
+        mapTotals = reg.mapRetired;
+        for (const auto &p : reg.mapLive)
+            if (p.first->cCalls)
+                mapTotals[*p.second].add(*p.first);
+    }
 
-    return false;
+    vector<pair<string, RegexStatsRegistry::Totals>> v(mapTotals.begin(), mapTotals.end());
+    std::sort(v.begin(),
+              v.end(),
+              [](const pair<string, RegexStatsRegistry::Totals> &a, const pair<string, RegexStatsRegistry::Totals> &b)
+              {
+                  return a.second.nsTime > b.second.nsTime;
+              });
+
+    char sz[100];
+    cout << "Regex statistics, sorted by time:\n";
+    cout << "    time ms       calls     matches  MB scanned  pattern\n";
+    for (const auto &p : v)
+    {
+        snprintf(sz, sizeof(sz), "%11.3f %11llu %11llu %11.2f  ",
+                 p.second.nsTime / 1e6,
+                 (unsigned long long)p.second.cCalls,
+                 (unsigned long long)p.second.cMatches,
+                 p.second.cbScanned / 1e6);
+        cout << sz << p.first << "\n";
+    }
+}
+
+#endif // XWP_REGEX_STATS
+
+/**
+ *  Called from the constructor to build the alternation for _re. Compiles every pattern on
+ *  its own first, so that an error names the pattern, and records in _vGroups and _vCaptures
+ *  where its captures end up in the alternation.
+ */
+string RegexSet::combine(const StringVector &vPatterns)
+{
+    string strCombined;
+    uint32_t iGroup = 1;
+    for (const auto &strPattern : vPatterns)
+    {
+        int iError = 0;
+        PCRE2_SIZE ofsError = 0;
+        pcre2_code *pRE;
+        if (!(pRE = pcre2_compile((PCRE2_SPTR)strPattern.c_str(),
+                                  strPattern.length(),
+                                  PCRE2_UTF | PCRE2_NO_UTF_CHECK,
+                                  &iError,
+                                  &ofsError,
+                                  NULL)))
+        {
+            PCRE2_UCHAR szError[256];
+            pcre2_get_error_message(iError, szError, sizeof(szError));
+            throw FSException("Error compiling regular expression " + quote(strPattern) + " at offset " + to_string(ofsError) + ": " + string((const char*)szError));
+        }
+        uint32_t cCaptures = 0;
+        pcre2_pattern_info(pRE, PCRE2_INFO_CAPTURECOUNT, &cCaptures);
+        pcre2_code_free(pRE);
+
+        _vGroups.push_back(iGroup);
+        _vCaptures.push_back(cCaptures);
+        iGroup += 1 + cCaptures;
+
+        if (!strCombined.empty())
+            strCombined += '|';
+        strCombined += "(" + strPattern + ")";
+    }
+
+    return strCombined;
+}
+
+RegexSet::RegexSet(const StringVector &vPatterns)
+    : _re(combine(vPatterns))
+{ }
+
+/**
+ *  Matches all the patterns against strHaystack in one pass and returns the index of the
+ *  pattern that matched (see the class description for which one that is), or -1 if none
+ *  did. If one did, aMatches receives the whole match and the captures of that pattern.
+ *
+ *  As with Regex::matches(), aMatches only records offsets into strHaystack.
+ */
+int RegexSet::matches(string_view strHaystack,
+                      RegexMatches &aMatches) const
+{
+    aMatches.pRE = &_re;
+
+    PCRE2_SIZE *ovector;
+    int rc = _re._pImpl->match(strHaystack,
+                               0,
+                               &ovector);
+    if (rc <= 0)
+        return -1;
+
+    for (size_t i = 0;
+         i < _vGroups.size();
+         ++i)
+    {
+        uint32_t iGroup = _vGroups[i];
+        if (    (iGroup < (uint32_t)rc)
+             && (ovector[iGroup * 2] != PCRE2_UNSET)
+           )
+        {
+            // Like pcre2_match(), leave out trailing captures that are not set.
+            uint32_t cPairs = std::min(_vCaptures[i] + 1, (uint32_t)rc - iGroup);
+            aMatches.reset(strHaystack, cPairs);
+            for (uint32_t u = 0;
+                 u < cPairs * 2;
+                 ++u)
+                aMatches._vOffsets[u] = ovector[iGroup * 2 + u];
+
+            return (int)i;
+        }
+    }
+
+    return -1;
 }
@@ -0,0 +1,412 @@
+/*
+ * phoxygen -- PHP documentation tool. (C) 2015--2016 Baubadil GmbH.
+ *
+ * phoxygen is free software; you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License as published by the Free Software Foundation, in version 2 as it comes
+ * in the "LICENSE" file of the phoxygen main distribution. This program is distributed in the hope
+ * that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the LICENSE file for more details.
+ */
+
+#include "xwp/simd.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define XWP_SIMD_X86
+    #include <immintrin.h>
+#endif
+
+namespace XWP
+{
+
+// Largest byte set that the vectorized findFirstOfCountingLines() supports.
+const size_t MAX_SET = 8;
+
+/***************************************************************************
+ *
+ *  Scalar versions, also used for the tails of the buffers
+ *
+ **************************************************************************/
+
+size_t findFirstOfScalar(const char *p,
+                         size_t cb,
+                         size_t ofs,
+                         string_view svSet,
+                         size_t &cNewlines,
+                         size_t &ofsLineStart)
+{
+    for (size_t i = ofs;
+         i < cb;
+         ++i)
+    {
+        char c = p[i];
+        if (svSet.find(c) != string_view::npos)
+            return i;
+        if (c == '\n')
+        {
+            ++cNewlines;
+            ofsLineStart = i + 1;
+        }
+    }
+
+    return string_view::npos;
+}
+
+size_t findInvalidUTF8Scalar(const char *p,
+                             size_t cb,
+                             size_t ofs)
+{
+    size_t i = ofs;
+    while (i < cb)
+    {
+        size_t cbSequence = getUTF8SequenceLength(string_view(p + i, cb - i));
+        if (!cbSequence)
+            return i;
+        i += cbSequence;
+    }
+
+    return string_view::npos;
+}
+
+#ifdef XWP_SIMD_X86
+
+/**
+ *  Adds the newlines in one block, given as a bit mask, to the counters.
+ */
+inline void addNewlines(uint32_t flNewlines,
+                        size_t ofsBlock,
+                        size_t &cNewlines,
+                        size_t &ofsLineStart)
+{
+    if (flNewlines)
+    {
+        cNewlines += __builtin_popcount(flNewlines);
+        ofsLineStart = ofsBlock + (31 - __builtin_clz(flNewlines)) + 1;
+    }
+}
+
+/***************************************************************************
+ *
+ *  SSE2 versions
+ *
+ **************************************************************************/
+
+size_t findFirstOfSSE2(const char *p,
+                       size_t cb,
+                       string_view svSet,
+                       size_t &cNewlines,
+                       size_t &ofsLineStart)
+{
+    __m128i aSet[MAX_SET];
+    size_t cSet = svSet.length();
+    for (size_t u = 0;
+         u < cSet;
+         ++u)
+        aSet[u] = _mm_set1_epi8(svSet[u]);
+    const __m128i vNewline = _mm_set1_epi8('\n');
+
+    size_t i = 0;
+    for (;
+         i + 16 <= cb;
+         i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i vHits = _mm_cmpeq_epi8(v, aSet[0]);
+        for (size_t u = 1;
+             u < cSet;
+             ++u)
+            vHits = _mm_or_si128(vHits, _mm_cmpeq_epi8(v, aSet[u]));
+
+        uint32_t flHits = _mm_movemask_epi8(vHits);
+        uint32_t flNewlines = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vNewline));
+        if (flHits)
+        {
+            uint bit = __builtin_ctz(flHits);
+            addNewlines(flNewlines & ((1u << bit) - 1), i, cNewlines, ofsLineStart);
+            return i + bit;
+        }
+        addNewlines(flNewlines, i, cNewlines, ofsLineStart);
+    }
+
+    return findFirstOfScalar(p, cb, i, svSet, cNewlines, ofsLineStart);
+}
+
+/**
+ *  Compares the first and the last byte of the needle at 16 positions at once and only
+ *  calls memcmp() where both match. The needle must have at least two bytes.
+ */
+size_t findStringSSE2(const char *p,
+                      size_t cb,
+                      const char *pNeedle,
+                      size_t cbNeedle)
+{
+    const __m128i vFirst = _mm_set1_epi8(pNeedle[0]);
+    const __m128i vLast = _mm_set1_epi8(pNeedle[cbNeedle - 1]);
+
+    size_t i = 0;
+    for (;
+         i + cbNeedle - 1 + 16 <= cb;
+         i += 16)
+    {
+        __m128i vA = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i vB = _mm_loadu_si128((const __m128i*)(p + i + cbNeedle - 1));
+        uint32_t fl = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(vA, vFirst),
+                                                      _mm_cmpeq_epi8(vB, vLast)));
+        while (fl)
+        {
+            uint bit = __builtin_ctz(fl);
+            if (!memcmp(p + i + bit + 1, pNeedle + 1, cbNeedle - 2))
+                return i + bit;
+            fl &= fl - 1;
+        }
+    }
+
+    return string_view(p, cb).find(string_view(pNeedle, cbNeedle), i);
+}
+
+/**
+ *  Skips 16 bytes at a time while they are ASCII, which is where the sign bits are clear.
+ */
+size_t findInvalidUTF8SSE2(const char *p,
+                           size_t cb)
+{
+    size_t i = 0;
+    while (i + 16 <= cb)
+    {
+        uint32_t fl = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p + i)));
+        if (!fl)
+        {
+            i += 16;
+            continue;
+        }
+
+        i += __builtin_ctz(fl);
+        size_t cbSequence = getUTF8SequenceLength(string_view(p + i, cb - i));
+        if (!cbSequence)
+            return i;
+        i += cbSequence;
+    }
+
+    return findInvalidUTF8Scalar(p, cb, i);
+}
+
+/***************************************************************************
+ *
+ *  AVX2 versions; the same as above with 32 bytes at a time
+ *
+ **************************************************************************/
+
+__attribute__((target("avx2")))
+size_t findFirstOfAVX2(const char *p,
+                       size_t cb,
+                       string_view svSet,
+                       size_t &cNewlines,
+                       size_t &ofsLineStart)
+{
+    __m256i aSet[MAX_SET];
+    size_t cSet = svSet.length();
+    for (size_t u = 0;
+         u < cSet;
+         ++u)
+        aSet[u] = _mm256_set1_epi8(svSet[u]);
+    const __m256i vNewline = _mm256_set1_epi8('\n');
+
+    size_t i = 0;
+    for (;
+         i + 32 <= cb;
+         i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i vHits = _mm256_cmpeq_epi8(v, aSet[0]);
+        for (size_t u = 1;
+             u < cSet;
+             ++u)
+            vHits = _mm256_or_si256(vHits, _mm256_cmpeq_epi8(v, aSet[u]));
+
+        uint32_t flHits = _mm256_movemask_epi8(vHits);
+        uint32_t flNewlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vNewline));
+        if (flHits)
+        {
+            uint bit = __builtin_ctz(flHits);
+            addNewlines(flNewlines & ((1u << bit) - 1), i, cNewlines, ofsLineStart);
+            return i + bit;
+        }
+        addNewlines(flNewlines, i, cNewlines, ofsLineStart);
+    }
+
+    return findFirstOfScalar(p, cb, i, svSet, cNewlines, ofsLineStart);
+}
+
+__attribute__((target("avx2")))
+size_t findStringAVX2(const char *p,
+                      size_t cb,
+                      const char *pNeedle,
+                      size_t cbNeedle)
+{
+    const __m256i vFirst = _mm256_set1_epi8(pNeedle[0]);
+    const __m256i vLast = _mm256_set1_epi8(pNeedle[cbNeedle - 1]);
+
+    size_t i = 0;
+    for (;
+         i + cbNeedle - 1 + 32 <= cb;
+         i += 32)
+    {
+        __m256i vA = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i vB = _mm256_loadu_si256((const __m256i*)(p + i + cbNeedle - 1));
+        uint32_t fl = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(vA, vFirst),
+                                                            _mm256_cmpeq_epi8(vB, vLast)));
+        while (fl)
+        {
+            uint bit = __builtin_ctz(fl);
+            if (!memcmp(p + i + bit + 1, pNeedle + 1, cbNeedle - 2))
+                return i + bit;
+            fl &= fl - 1;
+        }
+    }
+
+    return string_view(p, cb).find(string_view(pNeedle, cbNeedle), i);
+}
+
+__attribute__((target("avx2")))
+size_t findInvalidUTF8AVX2(const char *p,
+                           size_t cb)
+{
+    size_t i = 0;
+    while (i + 32 <= cb)
+    {
+        uint32_t fl = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(p + i)));
+        if (!fl)
+        {
+            i += 32;
+            continue;
+        }
+
+        i += __builtin_ctz(fl);
+        size_t cbSequence = getUTF8SequenceLength(string_view(p + i, cb - i));
+        if (!cbSequence)
+            return i;
+        i += cbSequence;
+    }
+
+    return findInvalidUTF8Scalar(p, cb, i);
+}
+
+bool hasAVX2()
+{
+    static const bool s_fAVX2 = __builtin_cpu_supports("avx2");
+    return s_fAVX2;
+}
+
+#endif // XWP_SIMD_X86
+
+/***************************************************************************
+ *
+ *  Public functions
+ *
+ **************************************************************************/
+
+size_t findFirstOfCountingLines(string_view sv,
+                                string_view svSet,
+                                size_t &cNewlines,
+                                size_t &ofsLineStart)
+{
+    cNewlines = 0;
+    ofsLineStart = 0;
+
+#ifdef XWP_SIMD_X86
+    if (    (!svSet.empty())
+         && (svSet.length() <= MAX_SET)
+       )
+    {
+        if (hasAVX2())
+            return findFirstOfAVX2(sv.data(), sv.length(), svSet, cNewlines, ofsLineStart);
+        return findFirstOfSSE2(sv.data(), sv.length(), svSet, cNewlines, ofsLineStart);
+    }
+#endif
+
+    return findFirstOfScalar(sv.data(), sv.length(), 0, svSet, cNewlines, ofsLineStart);
+}
+
+size_t findString(string_view svHaystack,
+                  string_view svNeedle)
+{
+    size_t cbNeedle = svNeedle.length();
+    if (    (cbNeedle < 2)
+         || (cbNeedle > svHaystack.length())
+       )
+        return svHaystack.find(svNeedle);
+
+#ifdef XWP_SIMD_X86
+    if (hasAVX2())
+        return findStringAVX2(svHaystack.data(), svHaystack.length(), svNeedle.data(), cbNeedle);
+    return findStringSSE2(svHaystack.data(), svHaystack.length(), svNeedle.data(), cbNeedle);
+#else
+    return svHaystack.find(svNeedle);
+#endif
+}
+
+size_t findInvalidUTF8(string_view sv)
+{
+#ifdef XWP_SIMD_X86
+    if (hasAVX2())
+        return findInvalidUTF8AVX2(sv.data(), sv.length());
+    return findInvalidUTF8SSE2(sv.data(), sv.length());
+#else
+    return findInvalidUTF8Scalar(sv.data(), sv.length(), 0);
+#endif
+}
+
+size_t getUTF8SequenceLength(string_view sv)
+{
+    const unsigned char *p = (const unsigned char*)sv.data();
+    size_t cb = sv.length();
+    if (!cb)
+        return 0;
+
+    unsigned char c = p[0];
+    if (c < 0x80)
+        return 1;
+
+    // The allowed range of the second byte depends on the first (see table 3-7 in the
+    // Unicode standard); that excludes overlong forms, surrogates and values above U+10FFFF.
+    size_t cbSequence;
+    unsigned char bMin = 0x80, bMax = 0xBF;
+    if (c < 0xC2)
+        return 0;
+    else if (c < 0xE0)
+        cbSequence = 2;
+    else if (c < 0xF0)
+    {
+        cbSequence = 3;
+        if (c == 0xE0)
+            bMin = 0xA0;
+        else if (c == 0xED)
+            bMax = 0x9F;
+    }
+    else if (c < 0xF5)
+    {
+        cbSequence = 4;
+        if (c == 0xF0)
+            bMin = 0x90;
+        else if (c == 0xF4)
+            bMax = 0x8F;
+    }
+    else
+        return 0;
+
+    if (    (cb < cbSequence)
+         || (p[1] < bMin)
+         || (p[1] > bMax)
+       )
+        return 0;
+    for (size_t i = 2;
+         i < cbSequence;
+         ++i)
+        if ((p[i] & 0xC0) != 0x80)
+            return 0;
+
+    return cbSequence;
+}
+
+} // namespace XWP
@@ -9,6 +9,7 @@
  */
 
 #include "xwp/stringhelp.h"
+#include "xwp/simd.h"
 
 #include <functional>
 #include <algorithm>
@@ -26,14 +27,14 @@ namespace XWP
 void ltrim(string &s)
 {
     s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-            std::not1(std::ptr_fun<int, int>(std::isspace))));
+            [](unsigned char c) { return !std::isspace(c); }));
 }
 
 // trim from end (in place)
 void rtrim(string &s)
 {
     s.erase(std::find_if(s.rbegin(), s.rend(),
-            std::not1(std::ptr_fun<int, int>(std::isspace))).base(), s.end());
+            [](unsigned char c) { return !std::isspace(c); }).base(), s.end());
 }
 
 // trim from both ends (in place)
@@ -43,11 +44,15 @@ void trim(string &s)
     rtrim(s);
 }
 
-string trimmed(const string &s)
+string trimmed(string_view sv)
 {
-    string s2(s);
-    trim(s2);
-    return s2;
+    size_t p1 = 0;
+    size_t p2 = sv.length();
+    while ((p1 < p2) && (isspace((unsigned char)sv[p1])))
+        ++p1;
+    while ((p2 > p1) && (isspace((unsigned char)sv[p2 - 1])))
+        --p2;
+    return string(sv.substr(p1, p2 - p1));
 }
 
 
@@ -198,6 +203,32 @@ string toLaTeX2(const string &ls,
     return strCopy;
 }
 
+/**
+ *  Returns a copy of sv in which every byte that is not part of a valid UTF-8 sequence
+ *  has been converted from Latin-1 to UTF-8. This turns Latin-1 text into UTF-8 and also
+ *  repairs UTF-8 text with a few stray Latin-1 bytes, without touching the valid parts.
+ */
+string makeValidUTF8(string_view sv)
+{
+    string str;
+    str.reserve(sv.length() + sv.length() / 8);
+
+    size_t ofs = 0;
+    size_t ofsInvalid;
+    while ((ofsInvalid = findInvalidUTF8(sv.substr(ofs))) != string_view::npos)
+    {
+        ofsInvalid += ofs;
+        str.append(sv.data() + ofs, ofsInvalid - ofs);
+        unsigned char c = sv[ofsInvalid];
+        str += (char)(0xC0 | (c >> 6));
+        str += (char)(0x80 | (c & 0x3F));
+        ofs = ofsInvalid + 1;
+    }
+    str.append(sv.data() + ofs, sv.length() - ofs);
+
+    return str;
+}
+
 void stringReplace(string &subject,
                    const string &search,
                    const string &replace)